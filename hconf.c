@@ -188,11 +188,11 @@ hconf_attach(device_t dev)
 	tlc_index = hidbus_get_index(dev);
 
 	/* Parse features for input mode switch */
-	if (hid_tlc_locate(d_ptr, d_len,
+	if (hid_index_locate(hidbus_get_report_descr(dev)->index,
 	    HID_USAGE2(HUP_DIGITIZERS, HUD_INPUT_MODE), hid_feature, tlc_index,
 	    0, &sc->input_mode_loc, &flags, &sc->input_mode_rid, NULL) &&
 	    (flags & (HIO_VARIABLE | HIO_RELATIVE)) == HIO_VARIABLE)
-		sc->input_mode_rlen = hid_report_size_1(d_ptr, d_len,
+		sc->input_mode_rlen = hidbus_get_report_size(dev,
 		    hid_feature, sc->input_mode_rid);
 
 	if (sc->input_mode_rlen > 1)
@@ -36,8 +36,10 @@
 #include <sys/kdb.h>
 #include <sys/kernel.h>
 #include <sys/lock.h>
+#include <sys/malloc.h>
 #include <sys/module.h>
 #include <sys/proc.h>
+#include <sys/systm.h>
 
 #include "hid.h"
 #include "hid_quirk.h"
@@ -123,6 +125,322 @@ hid_tlc_locate(const void *desc, hid_size_t size, int32_t u, enum hid_kind k,
 	return (0);
 }
 
+/*
+ * Compiled report descriptor index. Holds every input, output and feature
+ * item of the descriptor sorted by (TLC index, kind, usage, position) to
+ * make hid_tlc_locate()-alike lookups O(log n) instead of O(descriptor size).
+ */
+struct hid_index_item {
+	int32_t			usage;
+	uint32_t		flags;
+	struct hid_location	loc;
+	struct hid_absinfo	ai;
+	uint32_t		seq;		/* Position in descriptor */
+	uint8_t			tlc_index;
+	uint8_t			kind;
+	uint8_t			id;
+};
+
+/*
+ * Convert HID item location to form suitable for fast data extraction.
+ */
+void
+hid_cloc_compile(struct hid_cloc *cl, const struct hid_location *loc,
+    bool sign)
+{
+	uint32_t size;
+
+	/* Range check and limit */
+	size = MIN(loc->size, 32);
+
+	*cl = (struct hid_cloc) {
+		.off = loc->pos / 8,
+		.nbytes = (size + 7) / 8,
+		.shift = loc->pos % 8,
+		.lsh = 32 - size,
+		.sign = sign,
+	};
+}
+
+/*
+ * Extract HID item data from report which may be truncated. Missing bytes
+ * are read as zeroes like hid_get_data() does.
+ */
+uint32_t
+hid_cloc_get_slow(const struct hid_cloc *cl, const uint8_t *buf,
+    hid_size_t len)
+{
+	uint32_t data = 0;
+	uint8_t n;
+
+	if (cl->nbytes == 0)
+		return (0);
+
+	for (n = 0; n < cl->nbytes; n++)
+		if (cl->off + n < len)
+			data |= (uint32_t)buf[cl->off + n] << (8 * n);
+
+	data >>= cl->shift;
+	if (cl->sign)
+		return ((int32_t)(data << cl->lsh) >> cl->lsh);
+	return ((data << cl->lsh) >> cl->lsh);
+}
+
+#define	HID_INDEX_NKINDS	(hid_feature + 1)
+
+struct hid_index {
+	/* Report sizes in bytes per kind and report ID */
+	hid_size_t		rsize[HID_INDEX_NKINDS][256];
+	/* Maximal report sizes and first report IDs per kind */
+	hid_size_t		rsize_max[HID_INDEX_NKINDS];
+	uint8_t			rid[HID_INDEX_NKINDS];
+	uint32_t		nitems;
+	struct hid_index_item	items[];
+};
+
+struct hid_index_rpos {
+	uint32_t		lpos;
+	uint32_t		hpos;
+};
+
+static void
+hid_index_rpos_update(struct hid_index_rpos *rpos, const struct hid_item *h)
+{
+	uint32_t temp;
+
+	/* compute minimum */
+	if (rpos->lpos > h->loc.pos)
+		rpos->lpos = h->loc.pos;
+	/* compute end position */
+	temp = h->loc.pos + (h->loc.size * h->loc.count);
+	/* compute maximum */
+	if (rpos->hpos < temp)
+		rpos->hpos = temp;
+}
+
+static uint32_t
+hid_index_rpos_bits(const struct hid_index_rpos *rpos)
+{
+
+	/* safety check - can happen in case of currupt descriptors */
+	return (rpos->lpos > rpos->hpos ? 0 : rpos->hpos - rpos->lpos);
+}
+
+static int
+hid_index_cmp(const void *a, const void *b)
+{
+	const struct hid_index_item *ia = a, *ib = b;
+
+	if (ia->tlc_index != ib->tlc_index)
+		return (ia->tlc_index < ib->tlc_index ? -1 : 1);
+	if (ia->kind != ib->kind)
+		return (ia->kind < ib->kind ? -1 : 1);
+	if (ia->usage != ib->usage)
+		return (ia->usage < ib->usage ? -1 : 1);
+	if (ia->seq != ib->seq)
+		return (ia->seq < ib->seq ? -1 : 1);
+	return (0);
+}
+
+struct hid_index *
+hid_index_alloc(const void *desc, hid_size_t size)
+{
+	struct hid_index *idx;
+	struct hid_index_item *ii;
+	struct hid_index_rpos *rpos, rpos_max[HID_INDEX_NKINDS];
+	struct hid_data *d;
+	struct hid_item h;
+	uint32_t nitems = 0;
+	u_int tlc;
+	int k, id;
+
+	if (desc == NULL || size == 0)
+		return (NULL);
+
+	/*
+	 * Count items first to allocate the index in one chunk. Parser keeps
+	 * report positions only for kinds it has been asked for, so each kind
+	 * must be walked separately to get locations hid_tlc_locate() returns.
+	 */
+	for (k = 0; k < HID_INDEX_NKINDS; k++) {
+		tlc = 0;
+		d = hid_start_parse(desc, size, 1 << k);
+		while (tlc <= UINT8_MAX && hid_get_item(d, &h)) {
+			if (h.kind == hid_endcollection && h.collevel == 0)
+				tlc++;
+			else if (h.kind == k)
+				nitems++;
+		}
+		hid_end_parse(d);
+	}
+
+	idx = malloc(sizeof(*idx) + nitems * sizeof(idx->items[0]),
+	    M_DEVBUF, M_WAITOK | M_ZERO);
+	rpos = malloc(sizeof(*rpos) * HID_INDEX_NKINDS * 256, M_TEMP,
+	    M_WAITOK);
+	for (k = 0; k < HID_INDEX_NKINDS; k++) {
+		rpos_max[k] = (struct hid_index_rpos) { 0xFFFFFFFF, 0 };
+		for (id = 0; id < 256; id++)
+			rpos[k * 256 + id] = rpos_max[k];
+	}
+
+	/*
+	 * Walk TLCs the same way as HID_TLC_FOREACH_ITEM does. Report sizes
+	 * are calculated the same way as hid_report_size() does.
+	 */
+	ii = idx->items;
+	for (k = 0; k < HID_INDEX_NKINDS; k++) {
+		tlc = 0;
+		d = hid_start_parse(desc, size, 1 << k);
+		while (hid_get_item(d, &h)) {
+			if (h.kind == hid_endcollection && h.collevel == 0) {
+				tlc++;
+				continue;
+			}
+			if (h.kind != k)
+				continue;
+			if ((uint32_t)h.report_ID <= UINT8_MAX)
+				hid_index_rpos_update(
+				    &rpos[k * 256 + h.report_ID], &h);
+			hid_index_rpos_update(&rpos_max[k], &h);
+			if (h.report_ID != 0 && idx->rid[k] == 0)
+				idx->rid[k] = h.report_ID;
+			if (tlc > UINT8_MAX || ii >= idx->items + nitems)
+				continue;
+			*ii = (struct hid_index_item) {
+				.usage = h.usage,
+				.flags = h.flags,
+				.loc = h.loc,
+				.ai = (struct hid_absinfo) {
+					.max = h.logical_maximum,
+					.min = h.logical_minimum,
+					.res = hid_item_resolution(&h),
+				},
+				.seq = ii - idx->items,
+				.tlc_index = tlc,
+				.kind = k,
+				.id = h.report_ID,
+			};
+			ii++;
+		}
+		hid_end_parse(d);
+	}
+
+	idx->nitems = ii - idx->items;
+	qsort(idx->items, idx->nitems, sizeof(idx->items[0]), hid_index_cmp);
+
+	/* Return length in bytes rounded up. Add ID byte if necessary */
+	for (k = 0; k < HID_INDEX_NKINDS; k++) {
+		for (id = 0; id < 256; id++)
+			idx->rsize[k][id] =
+			    (hid_index_rpos_bits(&rpos[k * 256 + id]) + 7) / 8 +
+			    (id != 0 && rpos[k * 256 + id].lpos != 0xFFFFFFFF);
+		idx->rsize_max[k] = (hid_index_rpos_bits(&rpos_max[k]) +
+		    (idx->rid[k] != 0 ? 8 : 0) + 7) / 8;
+	}
+	free(rpos, M_TEMP);
+
+	return (idx);
+}
+
+void
+hid_index_free(struct hid_index *idx)
+{
+
+	free(idx, M_DEVBUF);
+}
+
+/*
+ * Same as hid_tlc_locate() but takes precompiled report descriptor index
+ * rather than raw report descriptor.
+ */
+int
+hid_index_locate(const struct hid_index *idx, int32_t u, enum hid_kind k,
+    uint8_t tlc_index, uint8_t index, struct hid_location *loc,
+    uint32_t *flags, uint8_t *id, struct hid_absinfo *ai)
+{
+	const struct hid_index_item key = {
+		.usage = u,
+		.seq = 0,
+		.tlc_index = tlc_index,
+		.kind = k,
+	};
+	const struct hid_index_item *ii;
+	uint32_t lo, hi, mid;
+
+	if (idx == NULL)
+		goto notfound;
+
+	/* Find the first item which is not less than the key */
+	lo = 0;
+	hi = idx->nitems;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (hid_index_cmp(idx->items + mid, &key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo + index >= idx->nitems)
+		goto notfound;
+	ii = idx->items + lo + index;
+	if (ii->tlc_index != tlc_index || ii->kind != k || ii->usage != u)
+		goto notfound;
+
+	if (loc != NULL)
+		*loc = ii->loc;
+	if (flags != NULL)
+		*flags = ii->flags;
+	if (id != NULL)
+		*id = ii->id;
+	if (ai != NULL && (ii->flags & HIO_RELATIVE) == 0)
+		*ai = ii->ai;
+	return (1);
+
+notfound:
+	if (loc != NULL)
+		loc->size = 0;
+	if (flags != NULL)
+		*flags = 0;
+	if (id != NULL)
+		*id = 0;
+	return (0);
+}
+
+/*
+ * Same as hid_report_size_1() but takes precompiled report descriptor index
+ */
+int
+hid_index_report_size(const struct hid_index *idx, enum hid_kind k,
+    uint8_t id)
+{
+
+	if (idx == NULL || k >= HID_INDEX_NKINDS)
+		return (0);
+
+	return (idx->rsize[k][id]);
+}
+
+/*
+ * Same as hid_report_size() but takes precompiled report descriptor index
+ */
+int
+hid_index_report_size_max(const struct hid_index *idx, enum hid_kind k,
+    uint8_t *id)
+{
+
+	if (idx == NULL || k >= HID_INDEX_NKINDS) {
+		if (id != NULL)
+			*id = 0;
+		return (0);
+	}
+
+	if (id != NULL)
+		*id = idx->rid[k];
+	return (idx->rsize_max[k]);
+}
+
 /*------------------------------------------------------------------------*
  *	hid_test_quirk - test a device for a given quirk
  *
@@ -31,6 +31,8 @@
 #ifndef _HID_H_
 #define	_HID_H_
 
+#include <sys/endian.h>
+
 #include <dev/usb/usb.h>
 #include <dev/usb/usbdi.h>
 #include <dev/usb/usbhid.h>
@@ -71,12 +73,27 @@ SYSCTL_DECL(_hw_hid);
 
 typedef usb_size_t hid_size_t;
 
+struct hid_index;
+
 struct hid_absinfo {
 	int32_t min;
 	int32_t max;
 	int32_t res;
 };
 
+/*
+ * Precompiled HID item location. Lets to extract HID item data from report
+ * with single load followed by shift and mask. Items larger than 32 bits are
+ * truncated the same way as hid_get_data() does.
+ */
+struct hid_cloc {
+	uint32_t	off;	/* Offset of the first byte */
+	uint8_t		nbytes;	/* Number of bytes to load. 0 - no data */
+	uint8_t		shift;	/* Offset of the first bit in first byte */
+	uint8_t		lsh;	/* 32 - item size in bits */
+	bool		sign;	/* Item data is signed */
+};
+
 struct hid_device_info {
 	char		name[80];
 	char		serial[80];
@@ -88,6 +105,17 @@ struct hid_device_info {
 	uint8_t		autoQuirk[HID_MAX_AUTO_QUIRK];
 };
 
+/* Element of GET_REPORT/SET_REPORT request batch, see hid_batch_report() */
+struct hid_report_req {
+	void		*data;
+	hid_size_t	len;	/* Report length or buffer size for GET_REPORT */
+	hid_size_t	actlen;	/* Received report length */
+	uint8_t		type;	/* HID_{INPUT,OUTPUT,FEATURE}_REPORT */
+	uint8_t		id;
+	bool		set;	/* SET_REPORT if true, GET_REPORT otherwise */
+	int		error;
+};
+
 /* OpenBSD/NetBSD compat shim */
 #define	HID_GET_USAGE(u) ((u) & 0xffff)
 #define	HID_GET_USAGE_PAGE(u) (((u) >> 16) & 0xffff)
@@ -102,6 +130,59 @@ hid_get_udata(const uint8_t *buf, hid_size_t len, struct hid_location *loc)
 	return (hid_get_data_unsigned(buf, len, loc));
 }
 
+/* Offset of the byte following the last byte of HID item in report */
+static __inline hid_size_t
+hid_cloc_end(const struct hid_cloc *cl)
+{
+	return (cl->off + cl->nbytes);
+}
+
+/*
+ * Extract HID item data without bounds checking. Caller must ensure that
+ * report is at least hid_cloc_end() bytes long.
+ */
+static __inline uint32_t
+hid_cloc_get_nocheck(const struct hid_cloc *cl, const uint8_t *buf)
+{
+	uint32_t data;
+
+	switch (cl->nbytes) {
+	case 0:
+		return (0);
+	case 1:
+		data = buf[cl->off];
+		break;
+	case 2:
+		data = le16dec(buf + cl->off);
+		break;
+	case 3:
+		data = le16dec(buf + cl->off) |
+		    (uint32_t)buf[cl->off + 2] << 16;
+		break;
+	default:
+		data = le32dec(buf + cl->off);
+		break;
+	}
+
+	/* Byte aligned 8, 16 and 32 bit items do not need shifting */
+	data >>= cl->shift;
+	if (cl->sign)
+		return ((int32_t)(data << cl->lsh) >> cl->lsh);
+	return ((data << cl->lsh) >> cl->lsh);
+}
+
+uint32_t	hid_cloc_get_slow(const struct hid_cloc *cl, const uint8_t *buf,
+		    hid_size_t len);
+
+/* Same as hid_get_data()/hid_get_udata() but takes precompiled location */
+static __inline uint32_t
+hid_cloc_get(const struct hid_cloc *cl, const uint8_t *buf, hid_size_t len)
+{
+	if (__predict_true(hid_cloc_end(cl) <= len))
+		return (hid_cloc_get_nocheck(cl, buf));
+	return (hid_cloc_get_slow(cl, buf, len));
+}
+
 extern hid_test_quirk_t *hid_test_quirk_p;
 
 /*
@@ -114,6 +195,18 @@ int	hid_tlc_locate(const void *desc, hid_size_t size, int32_t u,
 	    enum hid_kind k, uint8_t tlc_index, uint8_t index,
 	    struct hid_location *loc, uint32_t *flags, uint8_t *id,
 	    struct hid_absinfo *ai);
+void	hid_cloc_compile(struct hid_cloc *cl, const struct hid_location *loc,
+	    bool sign);
+struct hid_index *hid_index_alloc(const void *desc, hid_size_t size);
+void	hid_index_free(struct hid_index *idx);
+int	hid_index_locate(const struct hid_index *idx, int32_t u,
+	    enum hid_kind k, uint8_t tlc_index, uint8_t index,
+	    struct hid_location *loc, uint32_t *flags, uint8_t *id,
+	    struct hid_absinfo *ai);
+int	hid_index_report_size(const struct hid_index *idx, enum hid_kind k,
+	    uint8_t id);
+int	hid_index_report_size_max(const struct hid_index *idx,
+	    enum hid_kind k, uint8_t *id);
 bool	hid_test_quirk(const struct hid_device_info *dev_info, uint16_t quirk);
 int	hid_add_dynamic_quirk(struct hid_device_info *dev_info,
 	    uint16_t quirk);
@@ -31,6 +31,29 @@
 
 INTERFACE hid;
 
+CODE {
+	static int
+	hid_default_batch_report(device_t dev, struct hid_report_req *reqs,
+	    int nreqs)
+	{
+		struct hid_report_req *req;
+		int error = 0;
+
+		for (req = reqs; req < reqs + nreqs; req++) {
+			if (req->set)
+				req->error = HID_SET_REPORT(dev, req->data,
+				    req->len, req->type, req->id);
+			else
+				req->error = HID_GET_REPORT(dev, req->data,
+				    req->len, &req->actlen, req->type, req->id);
+			if (error == 0)
+				error = req->error;
+		}
+
+		return (error);
+	}
+};
+
 # Interrupts interface
 
 #
@@ -148,6 +171,18 @@ METHOD int set_report {
 	uint8_t id;
 };
 
+#
+# Execute a number of get_report and set_report requests in order as a single
+# unit. Transport may issue them in one bus transaction. Status of each request
+# is stored in its error field. Return value is the first non-zero status.
+# Default implementation issues requests one by one.
+#
+METHOD int batch_report {
+	device_t dev;
+	struct hid_report_req *reqs;
+	int nreqs;
+} DEFAULT hid_default_batch_report;
+
 #
 # Set duration between input reports (in mSec).
 #
@@ -29,6 +29,7 @@
 __FBSDID("$FreeBSD$");
 
 #include <sys/param.h>
+#include <sys/bitstring.h>
 #include <sys/bus.h>
 #include <sys/kernel.h>
 #include <sys/lock.h>
@@ -36,6 +37,7 @@ __FBSDID("$FreeBSD$");
 #include <sys/mutex.h>
 #include <sys/queue.h>
 #include <sys/systm.h>
+#include <sys/time.h>
 
 #include "hid.h"
 #include "hidbus.h"
@@ -55,6 +57,15 @@ __FBSDID("$FreeBSD$");
 
 static hid_intr_t	hidbus_intr;
 
+/* Subscription of hidbus child to input report with given ID */
+struct hidbus_sub {
+	struct hidbus_ivars		*tlc;
+	TAILQ_ENTRY(hidbus_sub)		link;
+	uint8_t				id;
+	bool				all;
+};
+TAILQ_HEAD(hidbus_sub_list, hidbus_sub);
+
 static device_probe_t	hidbus_probe;
 static device_attach_t	hidbus_attach;
 static device_detach_t	hidbus_detach;
@@ -70,6 +81,11 @@ struct hidbus_softc {
 	int				nest;	/* Child attach nesting lvl */
 
 	STAILQ_HEAD(, hidbus_ivars)	tlcs;
+	/* Running children indexed by input report ID they are interested in */
+	struct hidbus_sub_list		subs[256];
+	struct hidbus_sub_list		subs_all;
+	/* Arrival time of input report being dispatched */
+	sbintime_t			intr_time;
 };
 
 devclass_t hidbus_devclass;
@@ -82,17 +98,18 @@ hidbus_fill_report_descr(struct hidbus_report_descr *hrd, const void *data,
 
 	hrd->data = __DECONST(void *, data);
 	hrd->len = len;
+	hrd->index = hid_index_alloc(data, len);
 
 	/*
 	 * If report descriptor is not available yet, set maximal
 	 * report sizes high enough to allow hidraw to work.
 	 */
 	hrd->isize = len == 0 ? HID_RSIZE_MAX :
-	    hid_report_size(data, len, hid_input, &hrd->iid);
+	    hid_index_report_size_max(hrd->index, hid_input, &hrd->iid);
 	hrd->osize = len == 0 ? HID_RSIZE_MAX :
-	    hid_report_size(data, len, hid_output, &hrd->oid);
+	    hid_index_report_size_max(hrd->index, hid_output, &hrd->oid);
 	hrd->fsize = len == 0 ? HID_RSIZE_MAX :
-	    hid_report_size(data, len, hid_feature, &hrd->fid);
+	    hid_index_report_size_max(hrd->index, hid_feature, &hrd->fid);
 
 	if (hrd->isize > HID_RSIZE_MAX) {
 		DPRINTF("input size is too large, %u bytes (truncating)\n",
@@ -116,6 +133,91 @@ hidbus_fill_report_descr(struct hidbus_report_descr *hrd, const void *data,
 	return (error);
 }
 
+static void
+hidbus_link_subs(struct hidbus_softc *sc, struct hidbus_ivars *tlc)
+{
+	u_int i;
+
+	mtx_assert(sc->lock, MA_OWNED);
+
+	for (i = 0; i < tlc->nsubs; i++)
+		TAILQ_INSERT_TAIL(tlc->subs[i].all ?
+		    &sc->subs_all : &sc->subs[tlc->subs[i].id],
+		    &tlc->subs[i], link);
+}
+
+static void
+hidbus_unlink_subs(struct hidbus_softc *sc, struct hidbus_ivars *tlc)
+{
+	u_int i;
+
+	mtx_assert(sc->lock, MA_OWNED);
+
+	for (i = 0; i < tlc->nsubs; i++)
+		TAILQ_REMOVE(tlc->subs[i].all ?
+		    &sc->subs_all : &sc->subs[tlc->subs[i].id],
+		    &tlc->subs[i], link);
+}
+
+/*
+ * Build list of input report IDs carried by child's TLC. Child is subscribed
+ * to every report if it asked for that or if report descriptor is unknown.
+ */
+static void
+hidbus_update_subs(device_t bus, struct hidbus_ivars *tlc)
+{
+	struct hidbus_softc *sc = device_get_softc(bus);
+	bitstr_t bit_decl(ids, 256);
+	struct hidbus_sub *subs, *old;
+	struct hid_data *hd;
+	struct hid_item hi;
+	u_int nsubs, i;
+	int id;
+
+	bit_nclear(ids, 0, 255);
+	nsubs = 0;
+	if ((tlc->flags & HIDBUS_FLAG_ALL_REPORTS) == 0 &&
+	    sc->rdesc.data != NULL && sc->rdesc.len != 0) {
+		hd = hid_start_parse(sc->rdesc.data, sc->rdesc.len,
+		    1 << hid_input);
+		HID_TLC_FOREACH_ITEM(hd, &hi, tlc->index) {
+			if (hi.kind == hid_input &&
+			    (uint32_t)hi.report_ID <= UINT8_MAX &&
+			    !bit_test(ids, hi.report_ID)) {
+				bit_set(ids, hi.report_ID);
+				nsubs++;
+			}
+		}
+		hid_end_parse(hd);
+		subs = nsubs == 0 ? NULL : malloc(sizeof(*subs) * nsubs,
+		    M_DEVBUF, M_WAITOK | M_ZERO);
+		for (id = 0, i = 0; id < 256; id++) {
+			if (!bit_test(ids, id))
+				continue;
+			subs[i].tlc = tlc;
+			subs[i].id = id;
+			i++;
+		}
+	} else {
+		nsubs = 1;
+		subs = malloc(sizeof(*subs), M_DEVBUF, M_WAITOK | M_ZERO);
+		subs->tlc = tlc;
+		subs->all = true;
+	}
+
+	mtx_lock(sc->lock);
+	if (tlc->open)
+		hidbus_unlink_subs(sc, tlc);
+	old = tlc->subs;
+	tlc->subs = subs;
+	tlc->nsubs = nsubs;
+	if (tlc->open)
+		hidbus_link_subs(sc, tlc);
+	mtx_unlock(sc->lock);
+
+	free(old, M_DEVBUF);
+}
+
 static device_t
 hidbus_add_child(device_t dev, u_int order, const char *name, int unit)
 {
@@ -280,10 +382,13 @@ hidbus_attach(device_t dev)
 	device_t parent = device_get_parent(dev);
 	void *d_ptr = NULL;
 	hid_size_t d_len;
-	int error;
+	int error, i;
 
 	sc->dev = dev;
 	STAILQ_INIT(&sc->tlcs);
+	for (i = 0; i < nitems(sc->subs); i++)
+		TAILQ_INIT(&sc->subs[i]);
+	TAILQ_INIT(&sc->subs_all);
 	mtx_init(&sc->mtx, "hidbus lock", NULL, MTX_DEF);
 
 	d_len = devinfo->rdescsize;
@@ -317,6 +422,7 @@ hidbus_detach(device_t dev)
 
 	hidbus_detach_children(dev);
 	mtx_destroy(&sc->mtx);
+	hid_index_free(sc->rdesc.index);
 	free(sc->rdesc.data, M_DEVBUF);
 
 	return (0);
@@ -333,6 +439,7 @@ hidbus_child_deleted(device_t bus, device_t child)
 	mtx_lock(sc->lock);
 	STAILQ_REMOVE(&sc->tlcs, tlc, hidbus_ivars, link);
 	mtx_unlock(sc->lock);
+	free(tlc->subs, M_DEVBUF);
 	free(tlc, M_DEVBUF);
 }
 
@@ -348,6 +455,9 @@ hidbus_read_ivar(device_t bus, device_t child, int which, uintptr_t *result)
 	case HIDBUS_IVAR_USAGE:
 		*result = tlc->usage;
 		break;
+	case HIDBUS_IVAR_FLAGS:
+		*result = tlc->flags;
+		break;
 	case HIDBUS_IVAR_INTR:
 		*result = (uintptr_t)tlc->intr;
 		break;
@@ -368,10 +478,15 @@ hidbus_write_ivar(device_t bus, device_t child, int which, uintptr_t value)
 	switch (which) {
 	case HIDBUS_IVAR_INDEX:
 		tlc->index = value;
+		hidbus_update_subs(bus, tlc);
 		break;
 	case HIDBUS_IVAR_USAGE:
 		tlc->usage = value;
 		break;
+	case HIDBUS_IVAR_FLAGS:
+		tlc->flags = value;
+		hidbus_update_subs(bus, tlc);
+		break;
 	case HIDBUS_IVAR_INTR:
 		tlc->intr = (hid_intr_t *)value;
 		break;
@@ -439,20 +554,79 @@ hidbus_intr(void *context, void *buf, hid_size_t len)
 {
 	struct hidbus_softc *sc = context;
 	struct hidbus_ivars *tlc;
+	struct hidbus_sub *sub, *sub_tmp;
+	uint8_t id;
 
 	mtx_assert(sc->lock, MA_OWNED);
 
+	/* Transport backend may have supplied more precise arrival time */
+	if (sc->intr_time == 0)
+		sc->intr_time = sbinuptime();
+
 	/*
-	 * Broadcast input report to all subscribers.
-	 * TODO: Add check for input report ID.
+	 * Zero-length report carries no report ID. It is sent by transport
+	 * backends to notify that device went idle, so broadcast it to all
+	 * running children e.g. to let hmt release stuck touches.
 	 */
-	 STAILQ_FOREACH(tlc, &sc->tlcs, link) {
-		if (tlc->open) {
-			KASSERT(tlc->intr != NULL,
-			    ("hidbus: interrupt handler is NULL"));
-			tlc->intr(tlc->child, buf, len);
+	if (len == 0) {
+		STAILQ_FOREACH(tlc, &sc->tlcs, link) {
+			if (tlc->open) {
+				KASSERT(tlc->intr != NULL,
+				    ("hidbus: interrupt handler is NULL"));
+				tlc->intr(tlc->child, buf, len);
+			}
 		}
+		sc->intr_time = 0;
+		return;
+	}
+
+	/*
+	 * Pass input report to subscribers of its report ID and to children
+	 * which want to receive all the reports. Child may unsubscribe itself
+	 * by calling hidbus_intr_stop() from its interrupt handler.
+	 */
+	id = sc->rdesc.iid != 0 ? *(uint8_t *)buf : 0;
+	TAILQ_FOREACH_SAFE(sub, &sc->subs[id], link, sub_tmp) {
+		KASSERT(sub->tlc->intr != NULL,
+		    ("hidbus: interrupt handler is NULL"));
+		sub->tlc->intr(sub->tlc->child, buf, len);
+	}
+	TAILQ_FOREACH_SAFE(sub, &sc->subs_all, link, sub_tmp) {
+		KASSERT(sub->tlc->intr != NULL,
+		    ("hidbus: interrupt handler is NULL"));
+		sub->tlc->intr(sub->tlc->child, buf, len);
 	}
+
+	sc->intr_time = 0;
+}
+
+/*
+ * Set arrival time of the next input report. Called by transport backend
+ * with its interrupt context right before the interrupt handler, if the
+ * report has been received before it is passed to hidbus.
+ */
+void
+hidbus_set_intr_time(void *context, sbintime_t time)
+{
+	struct hidbus_softc *sc = context;
+
+	mtx_assert(sc->lock, MA_OWNED);
+
+	sc->intr_time = time;
+}
+
+/*
+ * Return arrival time of input report. Valid only within child interrupt
+ * handler.
+ */
+sbintime_t
+hidbus_get_intr_time(device_t child)
+{
+	struct hidbus_softc *sc = device_get_softc(device_get_parent(child));
+
+	mtx_assert(sc->lock, MA_OWNED);
+
+	return (sc->intr_time);
 }
 
 int
@@ -467,8 +641,10 @@ hidbus_intr_start(device_t child)
 
 	STAILQ_FOREACH(tlc, &sc->tlcs, link) {
 		open = open || tlc->open;
-		if (tlc->child == child)
+		if (tlc->child == child && !tlc->open) {
 			tlc->open = true;
+			hidbus_link_subs(sc, tlc);
+		}
 	}
 
 	if (open)
@@ -488,8 +664,10 @@ hidbus_intr_stop(device_t child)
 	mtx_assert(sc->lock, MA_OWNED);
 
 	STAILQ_FOREACH(tlc, &sc->tlcs, link) {
-		if (tlc->child == child)
+		if (tlc->child == child && tlc->open) {
 			tlc->open = false;
+			hidbus_unlink_subs(sc, tlc);
+		}
 		open = open || tlc->open;
 	}
 
@@ -516,6 +694,19 @@ hidbus_get_report_descr(device_t child)
 	return (&sc->rdesc);
 }
 
+/*
+ * Return size of the report of given kind and ID in bytes including ID byte.
+ * Sizes are precalculated at report descriptor registration time.
+ */
+int
+hidbus_get_report_size(device_t child, enum hid_kind k, uint8_t id)
+{
+	device_t bus = device_get_parent(child);
+	struct hidbus_softc *sc = device_get_softc(bus);
+
+	return (hid_index_report_size(sc->rdesc.index, k, id));
+}
+
 /*
  * HID interface.
  *
@@ -582,20 +773,25 @@ hid_set_report_descr(device_t dev, const void *data, hid_size_t len)
 	DPRINTFN(5, "data = %*D\n", len, data, " ");
 
 	error = hidbus_fill_report_descr(&rdesc, data, len);
-	if (error != 0)
+	if (error == 0)
+		error = hidbus_detach_children(dev);
+	if (error != 0) {
+		hid_index_free(rdesc.index);
 		return (error);
-
-	error = hidbus_detach_children(dev);
-	if (error != 0)
-		return(error);
+	}
 
 	/* Make private copy to handle a case of dynamicaly allocated data. */
 	rdesc.data = malloc(len, M_DEVBUF, M_ZERO | M_WAITOK);
 	bcopy(data, rdesc.data, len);
 	rdesc.overloaded = true;
+	hid_index_free(sc->rdesc.index);
 	free(sc->rdesc.data, M_DEVBUF);
 	bcopy(&rdesc, &sc->rdesc, sizeof(struct hidbus_report_descr));
 
+	/* Report IDs of surviving caller may be changed. Resubscribe it. */
+	if (!is_bus)
+		hidbus_update_subs(bus, device_get_ivars(dev));
+
 	error = hidbus_attach_children(bus);
 
 	return (error);
@@ -649,6 +845,13 @@ hid_set_report(device_t dev, const void *data, hid_size_t len, uint8_t type,
 	return (HID_SET_REPORT(device_get_parent(dev), data, len, type, id));
 }
 
+int
+hid_batch_report(device_t dev, struct hid_report_req *reqs, int nreqs)
+{
+
+	return (HID_BATCH_REPORT(device_get_parent(dev), reqs, nreqs));
+}
+
 int
 hid_set_idle(device_t dev, uint16_t duration, uint8_t id)
 {
@@ -695,6 +898,7 @@ static device_method_t hidbus_methods[] = {
 	DEVMETHOD(hid_write,		hid_write),
 	DEVMETHOD(hid_get_report,       hid_get_report),
 	DEVMETHOD(hid_set_report,       hid_set_report),
+	DEVMETHOD(hid_batch_report,	hid_batch_report),
 	DEVMETHOD(hid_set_idle,		hid_set_idle),
 	DEVMETHOD(hid_set_protocol,	hid_set_protocol),
 
@@ -711,3 +915,4 @@ driver_t hidbus_driver = {
 MODULE_VERSION(hidbus, 1);
 DRIVER_MODULE(hidbus, usbhid, hidbus_driver, hidbus_devclass, 0, 0);
 DRIVER_MODULE(hidbus, iichid, hidbus_driver, hidbus_devclass, 0, 0);
+DRIVER_MODULE(hidbus, vhid, hidbus_driver, hidbus_devclass, 0, 0);
@@ -29,6 +29,7 @@
 struct hidbus_report_descr {
 	void		*data;
 	hid_size_t	len;
+	struct hid_index *index;	/* Compiled report descriptor */
 	hid_size_t	isize;
 	hid_size_t	osize;
 	hid_size_t	fsize;
@@ -47,15 +48,20 @@ struct hidbus_ivars {
 	device_t			child;
 	int32_t				usage;
 	uint8_t				index;
+	uint32_t			flags;
+#define	HIDBUS_FLAG_ALL_REPORTS	0x01	/* Receive all input reports */
 	uintptr_t			driver_info;	/* for internal use */
 	hid_intr_t			*intr;
 	bool				open;
+	struct hidbus_sub		*subs;	/* Input report subscriptions */
+	u_int				nsubs;
 	STAILQ_ENTRY(hidbus_ivars)	link;
 };
 
 enum {
 	HIDBUS_IVAR_USAGE,
 	HIDBUS_IVAR_INDEX,
+	HIDBUS_IVAR_FLAGS,
 	HIDBUS_IVAR_INTR,
 	HIDBUS_IVAR_DRIVER_INFO,
 };
@@ -65,6 +71,7 @@ enum {
 
 HIDBUS_ACCESSOR(usage,		USAGE,		int32_t)
 HIDBUS_ACCESSOR(index,		INDEX,		uint8_t)
+HIDBUS_ACCESSOR(flags,		FLAGS,		uint32_t)
 HIDBUS_ACCESSOR(intr,		INTR,		hid_intr_t *)
 HIDBUS_ACCESSOR(driver_info,	DRIVER_INFO,	uintptr_t)
 
@@ -159,12 +166,15 @@ struct hid_device_id {
 const struct hid_device_id *hidbus_lookup_id(device_t,
 		    const struct hid_device_id *, size_t);
 struct hidbus_report_descr *hidbus_get_report_descr(device_t);
+int		hidbus_get_report_size(device_t, enum hid_kind, uint8_t);
 int		hidbus_lookup_driver_info(device_t,
 		    const struct hid_device_id *, size_t);
 struct mtx *	hidbus_get_lock(device_t);
 int		hidbus_intr_start(device_t);
 int		hidbus_intr_stop(device_t);
 void		hidbus_intr_poll(device_t);
+void		hidbus_set_intr_time(void *, sbintime_t);
+sbintime_t	hidbus_get_intr_time(device_t);
 void		hidbus_set_desc(device_t, const char *);
 
 /* hidbus HID interface */
@@ -175,6 +185,7 @@ int	hid_write(device_t, const void *, hid_size_t);
 int	hid_get_report(device_t, void *, hid_size_t, hid_size_t *, uint8_t,
 	    uint8_t);
 int	hid_set_report(device_t, const void *, hid_size_t, uint8_t, uint8_t);
+int	hid_batch_report(device_t, struct hid_report_req *, int);
 int	hid_set_idle(device_t, uint16_t, uint8_t);
 int	hid_set_protocol(device_t, uint16_t);
 
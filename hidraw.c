@@ -55,9 +55,20 @@ __FBSDID("$FreeBSD$");
 #include <sys/selinfo.h>
 #include <sys/sysctl.h>
 #include <sys/systm.h>
+#include <sys/time.h>
 #include <sys/tty.h>
 #include <sys/uio.h>
 
+#include <machine/atomic.h>
+
+#include <vm/vm.h>
+#include <vm/vm_param.h>
+#include <vm/vm_extern.h>
+#include <vm/vm_kern.h>
+#include <vm/vm_map.h>
+#include <vm/vm_object.h>
+#include <vm/vm_pager.h>
+
 #include "hid.h"
 #include "hidbus.h"
 #include "hidraw.h"
@@ -85,6 +96,22 @@ SYSCTL_INT(_hw_hid_hidraw, OID_AUTO, debug, CTLFLAG_RWTUN,
 		free((buf), M_DEVBUF);			\
 	}
 
+/*
+ * Input queue is a byte ring of hidraw_frame records, so the framed mode
+ * read(2) and mapped queue consumers see records as is. Records are never
+ * split at the end of the ring. If the record does not fit in to the rest
+ * of the ring, a wrap-around marker is stored instead and the record is
+ * placed at the ring start. Head and tail are free-running positions.
+ */
+#define	HIDRAW_QUSED(sc)	((size_t)((sc)->sc_qtail - (sc)->sc_qhead))
+#define	HIDRAW_QOFF(sc, pos)	((size_t)((pos) % (sc)->sc_qsize))
+#define	HIDRAW_QENT_DATA(hf)	((uint8_t *)((struct hidraw_frame *)(hf) + 1))
+/* Queue must hold at least two reports of the maximal size */
+#define	HIDRAW_QSIZE_MIN(sc)	(2 * HIDRAW_FRAME_SIZE((sc)->sc_rdesc->rdsize))
+#define	HIDRAW_QSIZE_DEFAULT(sc)					\
+	MIN(MAX(HIDRAW_BUFFER_SIZE * HIDRAW_FRAME_SIZE((sc)->sc_rdesc->rdsize),\
+	    HIDRAW_QSIZE_MIN(sc)), HIDRAW_QSIZE_MAX)
+
 struct hidraw_softc {
 	device_t sc_dev;		/* base device */
 
@@ -93,10 +120,15 @@ struct hidraw_softc {
 	struct hidbus_report_descr *sc_rdesc;
 	const struct hid_device_info *sc_hw;
 
-	uint8_t *sc_q;
-	hid_size_t *sc_qlen;
-	int sc_head;
-	int sc_tail;
+	uint8_t *sc_q;			/* input queue of hidraw_frame's */
+	size_t sc_qsize;		/* input queue size in bytes */
+	uint64_t sc_qhead;		/* position of the oldest record */
+	uint64_t sc_qtail;		/* position of free space */
+	vm_object_t sc_qobj;		/* VM object backing input queue */
+	struct hidraw_mmap_hdr *sc_hdr;	/* page shared with userland */
+	vm_object_t sc_hobj;		/* VM object backing sc_hdr */
+	uint64_t sc_dropped;		/* number of dropped input reports */
+	int sc_overflow;		/* HIDRAW_OVERFLOW_* policy */
 	int sc_sleepcnt;
 
 	struct selinfo sc_rsel;
@@ -110,6 +142,9 @@ struct hidraw_softc {
 		bool	uhid:1;		/* driver switched in to uhid mode */
 		bool	lock:1;		/* input queue sleepable lock */
 		bool	flush:1;	/* do not wait for data in read() */
+		bool	copy:1;		/* head records are being copied */
+		bool	framed:1;	/* read() returns hidraw_frame's */
+		bool	mapped:1;	/* input queue is mapped by userland */
 	} sc_state;
 	int sc_fflags;			/* access mode for open lifetime */
 
@@ -122,6 +157,7 @@ static d_write_t	hidraw_write;
 static d_ioctl_t	hidraw_ioctl;
 static d_poll_t		hidraw_poll;
 static d_kqfilter_t	hidraw_kqfilter;
+static d_mmap_single_t	hidraw_mmap_single;
 
 static d_priv_dtor_t	hidraw_dtor;
 
@@ -133,6 +169,7 @@ static struct cdevsw hidraw_cdevsw = {
 	.d_ioctl =	hidraw_ioctl,
 	.d_poll =	hidraw_poll,
 	.d_kqfilter =	hidraw_kqfilter,
+	.d_mmap_single = hidraw_mmap_single,
 	.d_name =	"hidraw",
 };
 
@@ -146,6 +183,21 @@ static device_detach_t	hidraw_detach;
 static int		hidraw_kqread(struct knote *, long);
 static void		hidraw_kqdetach(struct knote *);
 static void		hidraw_notify(struct hidraw_softc *);
+static bool		hidraw_q_fits(struct hidraw_softc *, hid_size_t);
+static void		hidraw_q_put(struct hidraw_softc *, const void *,
+			    hid_size_t, sbintime_t);
+static size_t		hidraw_q_span(struct hidraw_softc *, uint64_t,
+			    uint32_t *);
+static struct hidraw_frame *hidraw_q_peek(struct hidraw_softc *, uint32_t *);
+static void		hidraw_q_consume(struct hidraw_softc *, size_t);
+static void		hidraw_q_drop(struct hidraw_softc *);
+static void		hidraw_q_flush(struct hidraw_softc *);
+static void		hidraw_q_sync(struct hidraw_softc *);
+static void		hidraw_intr_resume(struct hidraw_softc *);
+static int		hidraw_read_frames(struct hidraw_softc *, struct uio *);
+static int		hidraw_q_alloc(struct hidraw_softc *);
+static void		hidraw_q_free(struct hidraw_softc *);
+static int		hidraw_q_resize(struct hidraw_softc *, size_t);
 
 static struct filterops hidraw_filterops_read = {
 	.f_isfd =	1,
@@ -213,6 +265,7 @@ hidraw_attach(device_t self)
 	}
 
 	hidbus_set_intr(sc->sc_dev, hidraw_intr);
+	hidbus_set_flags(sc->sc_dev, HIDBUS_FLAG_ALL_REPORTS);
 
 	return 0;
 }
@@ -248,26 +301,360 @@ hidraw_intr(void *context, void *buf, hid_size_t len)
 {
 	device_t dev = context;
 	struct hidraw_softc *sc = device_get_softc(dev);
-	int next;
+	sbintime_t now = hidbus_get_intr_time(dev);
+	uint64_t dropped = sc->sc_dropped;
 
 	DPRINTFN(5, "len=%d\n", len);
 	DPRINTFN(5, "data = %*D\n", len, buf, " ");
 
-	next = (sc->sc_tail + 1) % HIDRAW_BUFFER_SIZE;
-	if (next == sc->sc_head)
-		return;
+	hidraw_q_sync(sc);
+
+	/*
+	 * Make room for the report by dropping old ones. Record which is
+	 * being copied to userland can not be dropped, so drop the new
+	 * report instead in that case. Mapped queue consumer may access
+	 * any queued record at any time so nothing is dropped under it.
+	 */
+	if (sc->sc_overflow == HIDRAW_OVERFLOW_DROP_OLDEST &&
+	    !sc->sc_state.mapped) {
+		while (!hidraw_q_fits(sc, len) && HIDRAW_QUSED(sc) != 0 &&
+		    !sc->sc_state.copy) {
+			hidraw_q_drop(sc);
+			sc->sc_dropped++;
+		}
+	}
 
-	bcopy(buf, sc->sc_q + sc->sc_tail * sc->sc_rdesc->rdsize, len);
-	sc->sc_qlen[sc->sc_tail] = len;
-	sc->sc_tail = next;
+	if (!hidraw_q_fits(sc, len)) {
+		DPRINTFN(3, "queue overflown. Drop report");
+		sc->sc_dropped++;
+		goto done;
+	}
 
-	if ((next + 1) % HIDRAW_BUFFER_SIZE == sc->sc_head) {
+	hidraw_q_put(sc, buf, len, now);
+
+	if (sc->sc_overflow == HIDRAW_OVERFLOW_STOP &&
+	    !hidraw_q_fits(sc, sc->sc_rdesc->rdsize)) {
 		DPRINTFN(3, "queue overflown. Stop intr");
 		sc->sc_state.owfl = true;
 		hidbus_intr_stop(sc->sc_dev);
 	}
 
 	hidraw_notify(sc);
+done:
+	/* Publish drop counter to mapped queue consumer */
+	if (sc->sc_dropped != dropped)
+		sc->sc_hdr->hm_dropped = sc->sc_dropped;
+}
+
+/*
+ * Check if report of given length can be stored in the input queue taking
+ * space wasted on wrap-around in to account.
+ */
+static bool
+hidraw_q_fits(struct hidraw_softc *sc, hid_size_t len)
+{
+	size_t need = HIDRAW_FRAME_SIZE(len);
+	size_t gap = sc->sc_qsize - HIDRAW_QOFF(sc, sc->sc_qtail);
+
+	mtx_assert(sc->sc_mtx, MA_OWNED);
+
+	if (need > gap)
+		need += gap;
+
+	return (need <= sc->sc_qsize - HIDRAW_QUSED(sc));
+}
+
+static void
+hidraw_q_put(struct hidraw_softc *sc, const void *buf, hid_size_t len,
+    sbintime_t time)
+{
+	struct hidraw_frame *hf;
+	size_t need = HIDRAW_FRAME_SIZE(len);
+	size_t off = HIDRAW_QOFF(sc, sc->sc_qtail);
+	size_t gap = sc->sc_qsize - off;
+
+	mtx_assert(sc->sc_mtx, MA_OWNED);
+
+	if (need > gap) {
+		hf = (struct hidraw_frame *)(sc->sc_q + off);
+		hf->hf_len = HIDRAW_FRAME_WRAP;
+		sc->sc_qtail += gap;
+		off = 0;
+	}
+
+	hf = (struct hidraw_frame *)(sc->sc_q + off);
+	hf->hf_len = len;
+	hf->hf_id = (sc->sc_rdesc->iid != 0 && len > 0) ? *(uint8_t *)buf : 0;
+	bzero(hf->hf_reserved, sizeof(hf->hf_reserved));
+	hf->hf_time = sbttons(time);
+	bcopy(buf, HIDRAW_QENT_DATA(hf), len);
+	/* Do not leak stale data through frame padding */
+	bzero(HIDRAW_QENT_DATA(hf) + len, need - sizeof(*hf) - len);
+	sc->sc_qtail += need;
+
+	/* Publish the record to mapped queue consumer */
+	atomic_store_rel_64(&sc->sc_hdr->hm_tail, sc->sc_qtail);
+}
+
+/*
+ * Return size of the record at given queue position including padding or
+ * remainder of the ring for wrap-around marker. Return 0 if the record is
+ * malformed. Queue may be mapped in to userland writable, so its content
+ * is never trusted.
+ */
+static size_t
+hidraw_q_span(struct hidraw_softc *sc, uint64_t pos, uint32_t *lenp)
+{
+	size_t off = HIDRAW_QOFF(sc, pos);
+	size_t span;
+	uint32_t len;
+
+	len = ((volatile struct hidraw_frame *)(sc->sc_q + off))->hf_len;
+	if (len == HIDRAW_FRAME_WRAP)
+		span = sc->sc_qsize - off;
+	else if (len <= sc->sc_qsize)
+		span = HIDRAW_FRAME_SIZE(len);
+	else
+		return (0);
+
+	if (span > sc->sc_qtail - pos || span > sc->sc_qsize - off)
+		return (0);
+	if (lenp != NULL)
+		*lenp = len;
+
+	return (span);
+}
+
+/*
+ * Return the oldest record and store its length in *lenp skipping
+ * wrap-around markers. Malformed queue is flushed. Return NULL if the
+ * queue is empty.
+ */
+static struct hidraw_frame *
+hidraw_q_peek(struct hidraw_softc *sc, uint32_t *lenp)
+{
+	size_t span;
+
+	mtx_assert(sc->sc_mtx, MA_OWNED);
+
+	while (HIDRAW_QUSED(sc) != 0) {
+		span = hidraw_q_span(sc, sc->sc_qhead, lenp);
+		if (span == 0) {
+			DPRINTF("input queue is corrupted. Flush it\n");
+			hidraw_q_flush(sc);
+			break;
+		}
+		if (*lenp != HIDRAW_FRAME_WRAP)
+			return ((struct hidraw_frame *)
+			    (sc->sc_q + HIDRAW_QOFF(sc, sc->sc_qhead)));
+		hidraw_q_consume(sc, span);
+	}
+
+	return (NULL);
+}
+
+/* Remove the oldest record from input queue */
+static void
+hidraw_q_drop(struct hidraw_softc *sc)
+{
+	uint32_t len;
+
+	if (hidraw_q_peek(sc, &len) != NULL)
+		hidraw_q_consume(sc, HIDRAW_FRAME_SIZE(len));
+}
+
+/* Remove len bytes of records starting from the oldest one */
+static void
+hidraw_q_consume(struct hidraw_softc *sc, size_t len)
+{
+
+	mtx_assert(sc->sc_mtx, MA_OWNED);
+	KASSERT(len <= HIDRAW_QUSED(sc), ("input queue underflow"));
+
+	sc->sc_qhead += len;
+	/* Mapped consumer starts from records not consumed by read() */
+	if (!sc->sc_state.mapped)
+		atomic_store_rel_64(&sc->sc_hdr->hm_head, sc->sc_qhead);
+}
+
+/* Discard all queued records and tell mapped consumer to resync */
+static void
+hidraw_q_flush(struct hidraw_softc *sc)
+{
+
+	mtx_assert(sc->sc_mtx, MA_OWNED);
+
+	sc->sc_qhead = sc->sc_qtail;
+	sc->sc_hdr->hm_size = sc->sc_qsize;
+	atomic_store_rel_64(&sc->sc_hdr->hm_head, sc->sc_qhead);
+	atomic_store_rel_64(&sc->sc_hdr->hm_tail, sc->sc_qtail);
+	atomic_add_rel_32(&sc->sc_hdr->hm_gen, 1);
+}
+
+/*
+ * Release records processed by userland through mapped queue. Kernel
+ * consumer position is advanced over whole well-formed records only.
+ */
+static void
+hidraw_q_sync(struct hidraw_softc *sc)
+{
+	uint64_t head;
+	size_t span;
+
+	mtx_assert(sc->sc_mtx, MA_OWNED);
+
+	/* Records which are being copied out by read() must stay intact */
+	if (!sc->sc_state.mapped || sc->sc_state.copy)
+		return;
+
+	head = atomic_load_acq_64(&sc->sc_hdr->hm_head);
+	if (head - sc->sc_qhead > HIDRAW_QUSED(sc))
+		return;
+
+	while (head != sc->sc_qhead) {
+		span = hidraw_q_span(sc, sc->sc_qhead, NULL);
+		if (span == 0 || span > head - sc->sc_qhead)
+			break;
+		hidraw_q_consume(sc, span);
+	}
+
+	hidraw_intr_resume(sc);
+}
+
+/* Restart interrupts stopped on queue overflow if there is room now */
+static void
+hidraw_intr_resume(struct hidraw_softc *sc)
+{
+
+	mtx_assert(sc->sc_mtx, MA_OWNED);
+
+	if (sc->sc_state.owfl && hidraw_q_fits(sc, sc->sc_rdesc->rdsize)) {
+		DPRINTFN(3, "queue freed. Start intr");
+		sc->sc_state.owfl = false;
+		hidbus_intr_start(sc->sc_dev);
+	}
+}
+
+/*
+ * Allocate wired kernel memory backed by VM object, so it can be mapped
+ * in to userland with d_mmap_single. Object pages stay alive until both
+ * kernel and all user mappings are gone.
+ */
+static int
+hidraw_mem_alloc(vm_size_t size, vm_object_t *objp, void *kvap)
+{
+	vm_object_t obj;
+	vm_offset_t kva;
+
+	obj = vm_pager_allocate(OBJT_PHYS, NULL, size, VM_PROT_DEFAULT, 0,
+	    NULL);
+	if (obj == NULL)
+		return (ENOMEM);
+
+	/* Kernel map entry consumes one object reference */
+	vm_object_reference(obj);
+	kva = vm_map_min(kernel_map);
+	if (vm_map_find(kernel_map, obj, 0, &kva, size, 0, VMFS_OPTIMAL_SPACE,
+	    VM_PROT_READ | VM_PROT_WRITE, VM_PROT_READ | VM_PROT_WRITE, 0) !=
+	    KERN_SUCCESS) {
+		vm_object_deallocate(obj);
+		vm_object_deallocate(obj);
+		return (ENOMEM);
+	}
+	if (vm_map_wire(kernel_map, kva, kva + size,
+	    VM_MAP_WIRE_SYSTEM | VM_MAP_WIRE_NOHOLES) != KERN_SUCCESS) {
+		vm_map_remove(kernel_map, kva, kva + size);
+		vm_object_deallocate(obj);
+		return (ENOMEM);
+	}
+
+	*objp = obj;
+	*(void **)kvap = (void *)kva;
+
+	return (0);
+}
+
+static void
+hidraw_mem_free(vm_size_t size, vm_object_t obj, void *kva)
+{
+
+	vm_map_remove(kernel_map, (vm_offset_t)kva, (vm_offset_t)kva + size);
+	vm_object_deallocate(obj);
+}
+
+/* Allocate input queue of default size and mappable header page */
+static int
+hidraw_q_alloc(struct hidraw_softc *sc)
+{
+	int error;
+
+	sc->sc_qsize = HIDRAW_QSIZE_DEFAULT(sc);
+	error = hidraw_mem_alloc(round_page(sc->sc_qsize), &sc->sc_qobj,
+	    &sc->sc_q);
+	if (error != 0)
+		return (error);
+
+	error = hidraw_mem_alloc(PAGE_SIZE, &sc->sc_hobj, &sc->sc_hdr);
+	if (error != 0) {
+		hidraw_mem_free(round_page(sc->sc_qsize), sc->sc_qobj,
+		    sc->sc_q);
+		sc->sc_q = NULL;
+	}
+
+	return (error);
+}
+
+static void
+hidraw_q_free(struct hidraw_softc *sc)
+{
+
+	hidraw_mem_free(round_page(sc->sc_qsize), sc->sc_qobj, sc->sc_q);
+	hidraw_mem_free(PAGE_SIZE, sc->sc_hobj, sc->sc_hdr);
+	sc->sc_q = NULL;
+	sc->sc_hdr = NULL;
+}
+
+/*
+ * Replace input queue with empty one of given size. Input queue must be
+ * locked with hidraw_lock_queue() and interrupts must be stopped. Old
+ * queue stays accessible through existing user mappings.
+ */
+static int
+hidraw_q_resize(struct hidraw_softc *sc, size_t size)
+{
+	vm_object_t obj, oobj;
+	uint8_t *q, *oq;
+	size_t osize;
+	int error;
+
+	mtx_assert(sc->sc_mtx, MA_OWNED);
+	KASSERT(sc->sc_state.lock, ("input buffer is not locked"));
+
+	size = roundup2(size, HIDRAW_FRAME_ALIGN);
+	if (size < HIDRAW_QSIZE_MIN(sc) || size > HIDRAW_QSIZE_MAX)
+		return (EINVAL);
+
+	mtx_unlock(sc->sc_mtx);
+	error = hidraw_mem_alloc(round_page(size), &obj, &q);
+	mtx_lock(sc->sc_mtx);
+	if (error != 0)
+		return (error);
+
+	oobj = sc->sc_qobj;
+	oq = sc->sc_q;
+	osize = sc->sc_qsize;
+	sc->sc_qobj = obj;
+	sc->sc_q = q;
+	sc->sc_qsize = size;
+	sc->sc_qhead = sc->sc_qtail = 0;
+	sc->sc_state.mapped = false;
+	hidraw_q_flush(sc);
+
+	mtx_unlock(sc->sc_mtx);
+	hidraw_mem_free(round_page(osize), oobj, oq);
+	mtx_lock(sc->sc_mtx);
+
+	return (0);
 }
 
 static inline int
@@ -331,7 +718,12 @@ hidraw_open(struct cdev *dev, int flag, int mode, struct thread *td)
 	sc->sc_state.open = true;
 	mtx_unlock(sc->sc_mtx);
 
-	error = devfs_set_cdevpriv(sc, hidraw_dtor);
+	error = hidraw_q_alloc(sc);
+	if (error == 0) {
+		error = devfs_set_cdevpriv(sc, hidraw_dtor);
+		if (error != 0)
+			hidraw_q_free(sc);
+	}
 	if (error != 0) {
 		mtx_lock(sc->sc_mtx);
 		sc->sc_state.open = false;
@@ -339,19 +731,19 @@ hidraw_open(struct cdev *dev, int flag, int mode, struct thread *td)
 		return (error);
 	}
 
-	sc->sc_q = malloc(sc->sc_rdesc->rdsize * HIDRAW_BUFFER_SIZE, M_DEVBUF,
-	    M_ZERO | M_WAITOK);
-	sc->sc_qlen = malloc(sizeof(hid_size_t) * HIDRAW_BUFFER_SIZE, M_DEVBUF,
-	    M_ZERO | M_WAITOK);
-
 	/* Set up interrupt pipe. */
 	mtx_lock(sc->sc_mtx);
 	hidbus_intr_start(sc->sc_dev);
 	sc->sc_state.immed = false;
 	sc->sc_async = 0;
 	sc->sc_state.uhid = false;	/* hidraw mode is default */
+	sc->sc_state.framed = false;
 	sc->sc_state.owfl = false;
-	sc->sc_head = sc->sc_tail = 0;
+	sc->sc_state.mapped = false;
+	sc->sc_qhead = sc->sc_qtail = 0;
+	hidraw_q_flush(sc);
+	sc->sc_overflow = HIDRAW_OVERFLOW_DROP_OLDEST;
+	sc->sc_dropped = 0;
 	sc->sc_fflags = flag;
 	mtx_unlock(sc->sc_mtx);
 
@@ -369,13 +761,11 @@ hidraw_dtor(void *data)
 	mtx_lock(sc->sc_mtx);
 	if (!sc->sc_state.owfl)
 		hidbus_intr_stop(sc->sc_dev);
-	sc->sc_tail = sc->sc_head = 0;
+	sc->sc_qhead = sc->sc_qtail = 0;
 	sc->sc_async = 0;
 	mtx_unlock(sc->sc_mtx);
 
-	free(sc->sc_q, M_DEVBUF);
-	free(sc->sc_qlen, M_DEVBUF);
-	sc->sc_q = NULL;
+	hidraw_q_free(sc);
 
 	mtx_lock(sc->sc_mtx);
 	sc->sc_state.open = false;
@@ -385,8 +775,11 @@ hidraw_dtor(void *data)
 static int
 hidraw_read(struct cdev *dev, struct uio *uio, int flag)
 {
+	uint8_t local_buf[HIDRAW_LOCAL_BUFSIZE], *buf;
 	struct hidraw_softc *sc;
-	size_t length;
+	struct hidraw_frame *hf;
+	size_t length, copied, n;
+	uint32_t len;
 	int error;
 
 	DPRINTFN(1, "\n");
@@ -406,16 +799,28 @@ hidraw_read(struct cdev *dev, struct uio *uio, int flag)
 		mtx_unlock(sc->sc_mtx);
 		DPRINTFN(1, "immed\n");
 
-		error = hid_get_report(sc->sc_dev, sc->sc_q,
-		    sc->sc_rdesc->isize, NULL, HID_INPUT_REPORT,
-		    sc->sc_rdesc->iid);
+		/* Input queue holds live records, so do not read in to it */
+		buf = HIDRAW_LOCAL_ALLOC(local_buf, sc->sc_rdesc->isize);
+		error = hid_get_report(sc->sc_dev, buf, sc->sc_rdesc->isize,
+		    NULL, HID_INPUT_REPORT, sc->sc_rdesc->iid);
 		if (error == 0)
-			error = uiomove(sc->sc_q, sc->sc_rdesc->isize, uio);
+			error = uiomove(buf, sc->sc_rdesc->isize, uio);
+		HIDRAW_LOCAL_FREE(local_buf, buf);
 		mtx_lock(sc->sc_mtx);
 		goto exit;
 	}
 
-	while (sc->sc_tail == sc->sc_head && !sc->sc_state.flush) {
+	/*
+	 * Mapped queue consumer owns consumer position. Records consumed
+	 * by read() behind its back would be overwritten while still being
+	 * processed by userland.
+	 */
+	if (sc->sc_state.mapped) {
+		error = EBUSY;
+		goto exit;
+	}
+
+	while (HIDRAW_QUSED(sc) == 0 && !sc->sc_state.flush) {
 		if (flag & O_NONBLOCK) {
 			error = EWOULDBLOCK;
 			goto exit;
@@ -433,26 +838,38 @@ hidraw_read(struct cdev *dev, struct uio *uio, int flag)
 		}
 	}
 
-	while (sc->sc_tail != sc->sc_head && uio->uio_resid > 0) {
+	if (sc->sc_state.framed) {
+		error = hidraw_read_frames(sc, uio);
+		goto exit;
+	}
+
+	while (uio->uio_resid > 0 && (hf = hidraw_q_peek(sc, &len)) != NULL) {
 		length = min(uio->uio_resid, sc->sc_state.uhid ?
-		    sc->sc_rdesc->isize : sc->sc_qlen[sc->sc_head]);
+		    sc->sc_rdesc->isize : len);
+		sc->sc_state.copy = true;
 		mtx_unlock(sc->sc_mtx);
 
-		/* Copy the data to the user process. */
+		/*
+		 * Copy the data to the user process. Interrupt handler does
+		 * not touch the record marked as being copied and locked
+		 * queue can not be freed.
+		 */
 		DPRINTFN(5, "got %lu chars\n", (u_long)length);
-		error = uiomove(sc->sc_q + sc->sc_head * sc->sc_rdesc->rdsize,
-		    length, uio);
+		copied = MIN(length, len);
+		error = uiomove(HIDRAW_QENT_DATA(hf), copied, uio);
+		/* uhid(4) records are fixed size. Pad short reports */
+		for (; error == 0 && copied < length; copied += n) {
+			n = MIN(length - copied, ZERO_REGION_SIZE);
+			error = uiomove(__DECONST(void *, zero_region), n, uio);
+		}
 
 		mtx_lock(sc->sc_mtx);
+		sc->sc_state.copy = false;
 		if (error != 0)
 			goto exit;
 		/* Remove a small chunk from the input queue. */
-		sc->sc_head = (sc->sc_head + 1) % HIDRAW_BUFFER_SIZE;
-		if (sc->sc_state.owfl) {
-			DPRINTFN(3, "queue freed. Start intr");
-			sc->sc_state.owfl = false;
-			hidbus_intr_start(sc->sc_dev);
-		}
+		hidraw_q_consume(sc, HIDRAW_FRAME_SIZE(len));
+		hidraw_intr_resume(sc);
 		/*
 		 * In uhid mode transfer as many chunks as possible. Hidraw
 		 * packets are transferred one by one due to different length.
@@ -467,6 +884,53 @@ exit:
 	return (error);
 }
 
+/*
+ * Copy as many whole frames as fit in to user buffer. Frames are stored
+ * in the input queue in the same format, so each contiguous run of them
+ * is transferred with single uiomove() call.
+ */
+static int
+hidraw_read_frames(struct hidraw_softc *sc, struct uio *uio)
+{
+	ssize_t resid = uio->uio_resid;
+	size_t off, run, span;
+	uint32_t len;
+	int error = 0;
+
+	mtx_assert(sc->sc_mtx, MA_OWNED);
+
+	/* hidraw_q_peek() skips wrap-around marker and checks first frame */
+	while (hidraw_q_peek(sc, &len) != NULL) {
+		off = HIDRAW_QOFF(sc, sc->sc_qhead);
+		for (run = 0; off + run < sc->sc_qsize; run += span) {
+			span = hidraw_q_span(sc, sc->sc_qhead + run, &len);
+			if (span == 0 || len == HIDRAW_FRAME_WRAP ||
+			    (ssize_t)(run + span) > uio->uio_resid)
+				break;
+		}
+		if (run == 0) {
+			/* User buffer can not hold even a single frame */
+			if (uio->uio_resid == resid)
+				error = EMSGSIZE;
+			break;
+		}
+
+		sc->sc_state.copy = true;
+		mtx_unlock(sc->sc_mtx);
+		DPRINTFN(5, "got %lu chars\n", (u_long)run);
+		error = uiomove(sc->sc_q + off, run, uio);
+		mtx_lock(sc->sc_mtx);
+		sc->sc_state.copy = false;
+		if (error != 0)
+			break;
+
+		hidraw_q_consume(sc, run);
+		hidraw_intr_resume(sc);
+	}
+
+	return (error);
+}
+
 static int
 hidraw_write(struct cdev *dev, struct uio *uio, int flag)
 {
@@ -526,8 +990,8 @@ hidraw_ioctl(struct cdev *dev, u_long cmd, caddr_t addr, int flag,
 	struct usb_gen_descriptor *ugd;
 	struct hidraw_report_descriptor *hrd;
 	struct hidraw_devinfo *hdi;
+	struct hidraw_frame *hf;
 	uint32_t size;
-	hid_size_t ordsize;
 	int id, len;
 	int error = 0;
 
@@ -695,6 +1159,91 @@ hidraw_ioctl(struct cdev *dev, u_long cmd, caddr_t addr, int flag,
 		hdi->vendor = sc->sc_hw->idVendor;
 		hdi->product = sc->sc_hw->idProduct;
 		return (0);
+
+	case HIDIOCSQSIZE:
+		if (!(sc->sc_fflags & FREAD))
+			return (EPERM);
+		size = roundup2(*(uint32_t *)addr, HIDRAW_FRAME_ALIGN);
+		if (size < HIDRAW_QSIZE_MIN(sc) || size > HIDRAW_QSIZE_MAX)
+			return (EINVAL);
+
+		/* Stop interrupts and replace input report buffer */
+		mtx_lock(sc->sc_mtx);
+		error = hidraw_lock_queue(sc, true);
+		if (error != 0) {
+			mtx_unlock(sc->sc_mtx);
+			return (error);
+		}
+		if (sc->sc_state.owfl)
+			sc->sc_state.owfl = false;
+		else
+			hidbus_intr_stop(sc->sc_dev);
+		error = hidraw_q_resize(sc, size);
+		if (error == 0)
+			*(uint32_t *)addr = sc->sc_qsize;
+		hidbus_intr_start(sc->sc_dev);
+		hidraw_unlock_queue(sc);
+		mtx_unlock(sc->sc_mtx);
+		return (error);
+
+	case HIDIOCGQSIZE:
+		*(uint32_t *)addr = sc->sc_qsize;
+		return (0);
+
+	case HIDIOCSOVERFLOW:
+		switch (*(int *)addr) {
+		case HIDRAW_OVERFLOW_DROP_OLDEST:
+		case HIDRAW_OVERFLOW_DROP_NEWEST:
+		case HIDRAW_OVERFLOW_STOP:
+			break;
+		default:
+			return (EINVAL);
+		}
+		mtx_lock(sc->sc_mtx);
+		sc->sc_overflow = *(int *)addr;
+		if (sc->sc_state.owfl &&
+		    sc->sc_overflow != HIDRAW_OVERFLOW_STOP) {
+			DPRINTFN(3, "overflow policy changed. Start intr");
+			sc->sc_state.owfl = false;
+			hidbus_intr_start(sc->sc_dev);
+		}
+		mtx_unlock(sc->sc_mtx);
+		return (0);
+
+	case HIDIOCGOVERFLOW:
+		*(int *)addr = sc->sc_overflow;
+		return (0);
+
+	case HIDIOCSFRAMED:
+		mtx_lock(sc->sc_mtx);
+		sc->sc_state.framed = *(int *)addr != 0;
+		mtx_unlock(sc->sc_mtx);
+		return (0);
+
+	case HIDIOCGTIMESTAMP:
+		mtx_lock(sc->sc_mtx);
+		/* Peek may flush corrupted queue, so wait for running read() */
+		error = hidraw_lock_queue(sc, false);
+		if (error != 0) {
+			mtx_unlock(sc->sc_mtx);
+			return (error);
+		}
+		/* Skip records already processed by mapped queue consumer */
+		hidraw_q_sync(sc);
+		hf = hidraw_q_peek(sc, &size);
+		if (hf != NULL)
+			*(uint64_t *)addr = hf->hf_time;
+		else
+			error = EWOULDBLOCK;
+		hidraw_unlock_queue(sc);
+		mtx_unlock(sc->sc_mtx);
+		return (error);
+
+	case HIDIOCGDROPPED:
+		mtx_lock(sc->sc_mtx);
+		*(uint64_t *)addr = sc->sc_dropped;
+		mtx_unlock(sc->sc_mtx);
+		return (0);
 	}
 
 	/* variable-length ioctls handling */
@@ -749,31 +1298,29 @@ hidraw_ioctl(struct cdev *dev, u_long cmd, caddr_t addr, int flag,
 
 		/* Stop interrupts and clear input report buffer */
 		mtx_lock(sc->sc_mtx);
-		sc->sc_tail = sc->sc_head = 0;
 		if (sc->sc_state.owfl)
 			sc->sc_state.owfl = false;
 		else
 			hidbus_intr_stop(sc->sc_dev);
 		error = hidraw_lock_queue(sc, true);
+		/* Do not pull records from under reader in uiomove() */
+		if (error == 0)
+			hidraw_q_flush(sc);
 		mtx_unlock(sc->sc_mtx);
 		if (error != 0)
 			return(error);
 
 		/* Lock newbus around set_report_descr call */
 		mtx_lock(&Giant);
-		ordsize = sc->sc_rdesc->rdsize;
 		error = hid_set_report_descr(sc->sc_dev, addr, len);
 		mtx_unlock(&Giant);
-		/* Realloc hidraw input queue */
-		if (error == 0 && ordsize != sc->sc_rdesc->rdsize) {
-			free(sc->sc_q, M_DEVBUF);
-			sc->sc_q = malloc(
-			    sc->sc_rdesc->rdsize * HIDRAW_BUFFER_SIZE,
-			    M_DEVBUF, M_ZERO | M_WAITOK);
-		}
 
-		/* Start interrupts again */
+		/* Grow hidraw input queue if it can not hold new reports */
 		mtx_lock(sc->sc_mtx);
+		if (error == 0 && sc->sc_qsize < HIDRAW_QSIZE_MIN(sc))
+			error = hidraw_q_resize(sc, HIDRAW_QSIZE_MIN(sc));
+
+		/* Start interrupts again */
 		hidbus_intr_start(sc->sc_dev);
 		hidraw_unlock_queue(sc);
 		mtx_unlock(sc->sc_mtx);
@@ -797,7 +1344,8 @@ hidraw_poll(struct cdev *dev, int events, struct thread *td)
 		revents |= events & (POLLOUT | POLLWRNORM);
 	if (events & (POLLIN | POLLRDNORM) && (sc->sc_fflags & FREAD)) {
 		mtx_lock(sc->sc_mtx);
-		if (sc->sc_head != sc->sc_tail)
+		hidraw_q_sync(sc);
+		if (HIDRAW_QUSED(sc) != 0)
 			revents |= events & (POLLIN | POLLRDNORM);
 		else {
 			sc->sc_state.sel = true;
@@ -809,6 +1357,49 @@ hidraw_poll(struct cdev *dev, int events, struct thread *td)
 	return (revents);
 }
 
+/*
+ * Map header page read-write or input queue read-only. Mapped consumer
+ * gets EVFILT_READ/POLLIN notifications when kernel has records past
+ * the consumer position stored in the header.
+ */
+static int
+hidraw_mmap_single(struct cdev *dev, vm_ooffset_t *offset, vm_size_t size,
+    vm_object_t *object, int nprot)
+{
+	struct hidraw_softc *sc;
+	vm_object_t obj = NULL;
+	int error = 0;
+
+	sc = dev->si_drv1;
+	if (sc == NULL)
+		return (ENXIO);
+
+	if (!(sc->sc_fflags & FREAD))
+		return (EPERM);
+
+	mtx_lock(sc->sc_mtx);
+	if (*offset == HIDRAW_MMAP_HDR_OFFSET && size <= PAGE_SIZE)
+		obj = sc->sc_hobj;
+	else if (*offset == HIDRAW_MMAP_RING_OFFSET &&
+	    size <= round_page(sc->sc_qsize)) {
+		if (nprot & VM_PROT_WRITE)
+			error = EACCES;
+		else {
+			obj = sc->sc_qobj;
+			sc->sc_state.mapped = true;
+		}
+	} else
+		error = EINVAL;
+	if (obj != NULL) {
+		vm_object_reference(obj);
+		*object = obj;
+		*offset = 0;
+	}
+	mtx_unlock(sc->sc_mtx);
+
+	return (error);
+}
+
 static int
 hidraw_kqfilter(struct cdev *dev, struct knote *kn)
 {
@@ -847,8 +1438,10 @@ hidraw_kqread(struct knote *kn, long hint)
 	if (sc->dev->si_drv1 == NULL) {
 		kn->kn_flags |= EV_EOF;
 		ret = 1;
-	} else
-		ret = (sc->sc_head != sc->sc_tail) ? 1 : 0;
+	} else {
+		hidraw_q_sync(sc);
+		ret = (HIDRAW_QUSED(sc) != 0) ? 1 : 0;
+	}
 
 	return (ret);
 }
@@ -33,6 +33,7 @@
 #include <sys/ioccom.h>
 
 #define	HIDRAW_BUFFER_SIZE	64	/* number of input reports buffered */
+#define	HIDRAW_QSIZE_MAX	(1024 * 1024)	/* max input queue size */
 #define	HID_MAX_DESCRIPTOR_SIZE	4096	/* artificial limit taken from Linux */
 
 struct hidraw_report_descriptor {
@@ -40,6 +41,46 @@ struct hidraw_report_descriptor {
 	uint8_t		value[HID_MAX_DESCRIPTOR_SIZE];
 };
 
+/* Input report header returned by read(2) in framed mode */
+struct hidraw_frame {
+	uint32_t	hf_len;		/* Report length, header excluded */
+	uint8_t		hf_id;		/* Report ID or 0 */
+	uint8_t		hf_reserved[3];
+	uint64_t	hf_time;	/* Arrival time, CLOCK_UPTIME nsec */
+};
+
+#define	HIDRAW_FRAME_ALIGN	sizeof(uint64_t)
+#define	HIDRAW_FRAME_SIZE(len)	\
+	roundup2(sizeof(struct hidraw_frame) + (len), HIDRAW_FRAME_ALIGN)
+#define	HIDRAW_FRAME_WRAP	UINT32_MAX	/* Wrap-around marker hf_len */
+
+/*
+ * FreeBSD extension. Input queue can be consumed without syscalls through
+ * mmap(2). Header page is mapped read-write at HIDRAW_MMAP_HDR_OFFSET and
+ * the queue is mapped read-only at HIDRAW_MMAP_RING_OFFSET. The queue is
+ * a ring of hidraw_frame records. Record at position P starts at offset
+ * P % hm_size. Wrap-around marker means the next record is at the ring
+ * start. Consumer processes records from hm_head up to hm_tail and then
+ * stores new hm_head. Kernel never overwrites records past hm_head, so
+ * DROP_OLDEST policy acts as DROP_NEWEST while the queue is mapped.
+ * hm_gen is changed when the queue is flushed or reallocated; consumer
+ * should then remap the queue if hm_size changed and restart from hm_head.
+ * Consumer position is owned by userland once the queue is mapped, so
+ * read(2) fails with EBUSY until the queue is reallocated with HIDIOCSQSIZE
+ * or the device is reopened. Reports consumed with read(2) before mapping
+ * are already accounted in hm_head.
+ */
+struct hidraw_mmap_hdr {
+	uint32_t		hm_size;	/* Queue size in bytes */
+	volatile uint32_t	hm_gen;		/* Queue generation */
+	volatile uint64_t	hm_head;	/* Consumer position */
+	volatile uint64_t	hm_tail;	/* Producer position */
+	volatile uint64_t	hm_dropped;	/* Number of dropped reports */
+};
+
+#define	HIDRAW_MMAP_HDR_OFFSET	0
+#define	HIDRAW_MMAP_RING_OFFSET	0x10000
+
 struct hidraw_devinfo {
 	uint32_t	bustype;
 	int16_t		vendor;
@@ -57,5 +98,36 @@ struct hidraw_devinfo {
 
 /* FreeBSD extension. Set report descriptor. */
 #define	HIDIOCSRDESC(len)	_IOC(IOC_IN, 'H', 0x02, len)
+/*
+ * FreeBSD extension. Set and get input queue size in bytes. Queue size is
+ * rounded up and the actual value is returned. Queued reports are flushed.
+ */
+#define	HIDIOCSQSIZE		_IOWR('H', 0x20, uint32_t)
+#define	HIDIOCGQSIZE		_IOR('H', 0x21, uint32_t)
+/*
+ * FreeBSD extension. Set and get input queue overflow policy. Get number
+ * of input reports dropped since open.
+ */
+#define	HIDIOCSOVERFLOW		_IOW('H', 0x22, int)
+#define	HIDIOCGOVERFLOW		_IOR('H', 0x23, int)
+#define	HIDIOCGDROPPED		_IOR('H', 0x24, uint64_t)
+/*
+ * FreeBSD extension. Enable or disable framed read mode. In framed mode
+ * read(2) returns as many whole input reports as fit in to the buffer.
+ * Each report is preceded with hidraw_frame header and padded up to
+ * HIDRAW_FRAME_ALIGN boundary. Buffer must hold at least one frame.
+ */
+#define	HIDIOCSFRAMED		_IOW('H', 0x25, int)
+/*
+ * FreeBSD extension. Get arrival time of the input report to be returned
+ * by the next read(2) or of the oldest report not yet released through
+ * hm_head of mapped queue, in the same units as hf_time.
+ */
+#define	HIDIOCGTIMESTAMP	_IOR('H', 0x26, uint64_t)
+
+/* Input queue overflow policies */
+#define	HIDRAW_OVERFLOW_DROP_OLDEST	0	/* Drop oldest (default) */
+#define	HIDRAW_OVERFLOW_DROP_NEWEST	1	/* Drop incoming report */
+#define	HIDRAW_OVERFLOW_STOP		2	/* Stop device interrupts */
 
 #endif	/* _HIDRAW_H */
@@ -132,9 +132,10 @@ struct hkbd_softc {
 	accentmap_t sc_accmap;
 	fkeytab_t sc_fkeymap[HKBD_NFKEY];
 	uint64_t sc_loc_key_valid[howmany(HKBD_NKEYCODE, 64)];
-	struct hid_location sc_loc_apple_eject;
-	struct hid_location sc_loc_apple_fn;
-	struct hid_location sc_loc_key[HKBD_NKEYCODE];
+	struct hid_cloc sc_loc_apple_eject;
+	struct hid_cloc sc_loc_apple_fn;
+	struct hid_cloc sc_loc_key[HKBD_NKEYCODE];
+	uint32_t sc_nkeys_array;	/* Number of key event array slots */
 	struct hid_location sc_loc_numlock;
 	struct hid_location sc_loc_capslock;
 	struct hid_location sc_loc_scrolllock;
@@ -666,12 +667,12 @@ hkbd_intr_callback(void *context, void *data, hid_size_t len)
 	/* scan through HID data */
 	if ((sc->sc_flags & HKBD_FLAG_APPLE_EJECT) &&
 	    (id == sc->sc_id_apple_eject)) {
-		if (hid_get_data(buf, len, &sc->sc_loc_apple_eject))
+		if (hid_cloc_get(&sc->sc_loc_apple_eject, buf, len))
 			modifiers |= MOD_EJECT;
 	}
 	if ((sc->sc_flags & HKBD_FLAG_APPLE_FN) &&
 	    (id == sc->sc_id_apple_fn)) {
-		if (hid_get_data(buf, len, &sc->sc_loc_apple_fn))
+		if (hid_cloc_get(&sc->sc_loc_apple_fn, buf, len))
 			modifiers |= MOD_FN;
 	}
 
@@ -687,13 +688,13 @@ hkbd_intr_callback(void *context, void *data, hid_size_t len)
 		} else if (id != sc->sc_id_loc_key[i]) {
 			continue;	/* invalid HID ID */
 		} else if (i == 0) {
-			offset = sc->sc_loc_key[0].count;
+			offset = sc->sc_nkeys_array;
 			if (offset < 0 || offset > len)
 				offset = len;
 			while (offset--) {
 				uint32_t key =
-				    hid_get_data(buf + offset, len - offset,
-				    &sc->sc_loc_key[i]);
+				    hid_cloc_get(&sc->sc_loc_key[i],
+				    buf + offset, len - offset);
 				if (modifiers & MOD_FN)
 					key = hkbd_apple_fn(key);
 				if (sc->sc_flags & HKBD_FLAG_APPLE_SWAP)
@@ -703,7 +704,7 @@ hkbd_intr_callback(void *context, void *data, hid_size_t len)
 				/* set key in bitmap */
 				sc->sc_ndata.bitmap[key / 64] |= 1ULL << (key % 64);
 			}
-		} else if (hid_get_data(buf, len, &sc->sc_loc_key[i])) {
+		} else if (hid_cloc_get(&sc->sc_loc_key[i], buf, len)) {
 			uint32_t key = i;
 
 			if (modifiers & MOD_FN)
@@ -755,103 +756,151 @@ hkbd_probe(device_t dev)
 
 static void
 hkbd_parse_hid(struct hkbd_softc *sc, const uint8_t *ptr, uint32_t len,
-    uint8_t tlc_index)
+    const struct hid_index *hidx, uint8_t tlc_index)
 {
-	uint32_t flags;
-	uint32_t key;
-	uint8_t id;
+	uint64_t found[howmany(HKBD_NKEYCODE, 64)];
+	struct hid_location led_loc[3];
+	struct hid_data *hd;
+	struct hid_item hi;
+	uint32_t led_flags[3];
+	uint32_t key, led;
+	uint8_t led_id[3];
+	uint8_t led_found = 0;
+	bool apple_eject = false, apple_fn = false;
 
 	/* reset detected bits */
 	sc->sc_flags &= ~HKBD_FLAG_HID_MASK;
 
 	/* reset detected keys */
 	memset(sc->sc_loc_key_valid, 0, sizeof(sc->sc_loc_key_valid));
+	memset(sc->sc_loc_key, 0, sizeof(sc->sc_loc_key));
+	sc->sc_nkeys_array = 0;
+	memset(sc->sc_id_loc_key, 0, sizeof(sc->sc_id_loc_key));
+	memset(&sc->sc_loc_apple_eject, 0, sizeof(sc->sc_loc_apple_eject));
+	memset(&sc->sc_loc_apple_fn, 0, sizeof(sc->sc_loc_apple_fn));
+	sc->sc_id_apple_eject = 0;
+	sc->sc_id_apple_fn = 0;
+	memset(found, 0, sizeof(found));
 
 	/* check if there is an ID byte */
-	sc->sc_kbd_size = hid_report_size(ptr, len,
-	    hid_input, &sc->sc_kbd_id);
-
-	/* investigate if this is an Apple Keyboard */
-	if (hid_tlc_locate(ptr, len,
-	    HID_USAGE2(HUP_CONSUMER, HUG_APPLE_EJECT),
-	    hid_input, tlc_index, 0, &sc->sc_loc_apple_eject, &flags,
-	    &sc->sc_id_apple_eject, NULL)) {
-		if (flags & HIO_VARIABLE)
-			sc->sc_flags |= HKBD_FLAG_APPLE_EJECT | 
-			    HKBD_FLAG_APPLE_SWAP;
-		DPRINTFN(1, "Found Apple eject-key\n");
-	}
-	if (hid_tlc_locate(ptr, len,
-	    HID_USAGE2(0xFFFF, 0x0003),
-	    hid_input, tlc_index, 0, &sc->sc_loc_apple_fn, &flags,
-	    &sc->sc_id_apple_fn, NULL)) {
-		if (flags & HIO_VARIABLE)
-			sc->sc_flags |= HKBD_FLAG_APPLE_FN;
-		DPRINTFN(1, "Found Apple FN-key\n");
-	}
-
-	/* figure out event buffer */
-	if (hid_tlc_locate(ptr, len,
-	    HID_USAGE2(HUP_KEYBOARD, 0x00),
-	    hid_input, tlc_index, 0, &sc->sc_loc_key[0], &flags,
-	    &sc->sc_id_loc_key[0], NULL)) {
-		if (flags & HIO_VARIABLE) {
-			DPRINTFN(1, "Ignoring keyboard event control\n");
-		} else {
-			sc->sc_loc_key_valid[0] |= 1;
-			DPRINTFN(1, "Found keyboard event array\n");
-		}
-	}
+	sc->sc_kbd_size = hidx != NULL ?
+	    hid_index_report_size_max(hidx, hid_input, &sc->sc_kbd_id) :
+	    hid_report_size(ptr, len, hid_input, &sc->sc_kbd_id);
 
-	/* figure out the keys */
-	for (key = 1; key != HKBD_NKEYCODE; key++) {
-		if (hid_tlc_locate(ptr, len,
-		    HID_USAGE2(HUP_KEYBOARD, key),
-		    hid_input, tlc_index, 0, &sc->sc_loc_key[key], &flags,
-		    &sc->sc_id_loc_key[key], NULL)) {
-			if (flags & HIO_VARIABLE) {
+	/*
+	 * Collect keys and Apple keys in a single pass over input items of the
+	 * TLC and LEDs in another one over output items. Parser tracks report
+	 * positions only for requested item kinds, so kinds can not be mixed
+	 * in one pass. Only the first occurrence of each usage is taken in to
+	 * account.
+	 */
+	hd = hid_start_parse(ptr, len, 1 << hid_input);
+	HID_TLC_FOREACH_ITEM(hd, &hi, tlc_index) {
+		if (hi.kind != hid_input)
+			continue;
+		if (HID_GET_USAGE_PAGE(hi.usage) == HUP_KEYBOARD &&
+		    HID_GET_USAGE(hi.usage) < HKBD_NKEYCODE) {
+			key = HID_GET_USAGE(hi.usage);
+			if (found[key / 64] & (1ULL << (key % 64)))
+				continue;
+			found[key / 64] |= 1ULL << (key % 64);
+			hid_cloc_compile(&sc->sc_loc_key[key], &hi.loc, true);
+			sc->sc_id_loc_key[key] = hi.report_ID;
+			if (key == 0)
+				sc->sc_nkeys_array = hi.loc.count;
+			/* figure out event buffer */
+			if (key == 0) {
+				if (hi.flags & HIO_VARIABLE) {
+					DPRINTFN(1, "Ignoring keyboard event "
+					    "control\n");
+				} else {
+					sc->sc_loc_key_valid[0] |= 1;
+					DPRINTFN(1, "Found keyboard event "
+					    "array\n");
+				}
+			} else if (hi.flags & HIO_VARIABLE) {
 				sc->sc_loc_key_valid[key / 64] |=
 				    1ULL << (key % 64);
 				DPRINTFN(1, "Found key 0x%02x\n", key);
 			}
+			continue;
+		}
+		/* investigate if this is an Apple Keyboard */
+		if (hi.usage == HID_USAGE2(HUP_CONSUMER, HUG_APPLE_EJECT) &&
+		    !apple_eject) {
+			apple_eject = true;
+			hid_cloc_compile(&sc->sc_loc_apple_eject, &hi.loc,
+			    true);
+			sc->sc_id_apple_eject = hi.report_ID;
+			if (hi.flags & HIO_VARIABLE)
+				sc->sc_flags |= HKBD_FLAG_APPLE_EJECT |
+				    HKBD_FLAG_APPLE_SWAP;
+			DPRINTFN(1, "Found Apple eject-key\n");
+		}
+		if (hi.usage == HID_USAGE2(0xFFFF, 0x0003) && !apple_fn) {
+			apple_fn = true;
+			hid_cloc_compile(&sc->sc_loc_apple_fn, &hi.loc, true);
+			sc->sc_id_apple_fn = hi.report_ID;
+			if (hi.flags & HIO_VARIABLE)
+				sc->sc_flags |= HKBD_FLAG_APPLE_FN;
+			DPRINTFN(1, "Found Apple FN-key\n");
 		}
 	}
+	hid_end_parse(hd);
 
 	/* figure out leds on keyboard */
-	if (hid_tlc_locate(ptr, len,
-	    HID_USAGE2(HUP_LEDS, 0x01),
-	    hid_output, tlc_index, 0, &sc->sc_loc_numlock, &flags,
-	    &sc->sc_id_leds, NULL)) {
-		if (flags & HIO_VARIABLE)
+	hd = hid_start_parse(ptr, len, 1 << hid_output);
+	HID_TLC_FOREACH_ITEM(hd, &hi, tlc_index) {
+		if (hi.kind != hid_output ||
+		    HID_GET_USAGE_PAGE(hi.usage) != HUP_LEDS)
+			continue;
+		led = HID_GET_USAGE(hi.usage) - 1;
+		if (led >= nitems(led_loc) || led_found & (1 << led))
+			continue;
+		led_found |= 1 << led;
+		led_loc[led] = hi.loc;
+		led_flags[led] = hi.flags;
+		led_id[led] = hi.report_ID;
+	}
+	hid_end_parse(hd);
+
+	/* All LEDs are expected to reside in the report of the first one */
+	sc->sc_id_leds = 0;
+	memset(&sc->sc_loc_numlock, 0, sizeof(sc->sc_loc_numlock));
+	memset(&sc->sc_loc_capslock, 0, sizeof(sc->sc_loc_capslock));
+	memset(&sc->sc_loc_scrolllock, 0, sizeof(sc->sc_loc_scrolllock));
+	if (led_found & (1 << 0)) {
+		sc->sc_loc_numlock = led_loc[0];
+		sc->sc_id_leds = led_id[0];
+		if (led_flags[0] & HIO_VARIABLE)
 			sc->sc_flags |= HKBD_FLAG_NUMLOCK;
 		DPRINTFN(1, "Found keyboard numlock\n");
 	}
-	if (hid_tlc_locate(ptr, len,
-	    HID_USAGE2(HUP_LEDS, 0x02),
-	    hid_output, tlc_index, 0, &sc->sc_loc_capslock, &flags,
-	    &id, NULL)) {
+	if (led_found & (1 << 1)) {
+		sc->sc_loc_capslock = led_loc[1];
 		if ((sc->sc_flags & HKBD_FLAG_NUMLOCK) == 0)
-			sc->sc_id_leds = id;
-		if (flags & HIO_VARIABLE && sc->sc_id_leds == id)
+			sc->sc_id_leds = led_id[1];
+		if (led_flags[1] & HIO_VARIABLE &&
+		    sc->sc_id_leds == led_id[1])
 			sc->sc_flags |= HKBD_FLAG_CAPSLOCK;
 		DPRINTFN(1, "Found keyboard capslock\n");
 	}
-	if (hid_tlc_locate(ptr, len,
-	    HID_USAGE2(HUP_LEDS, 0x03),
-	    hid_output, tlc_index, 0, &sc->sc_loc_scrolllock, &flags,
-	    &id, NULL)) {
+	if (led_found & (1 << 2)) {
+		sc->sc_loc_scrolllock = led_loc[2];
 		if ((sc->sc_flags & (HKBD_FLAG_NUMLOCK | HKBD_FLAG_CAPSLOCK))
 		    == 0)
-			sc->sc_id_leds = id;
-		if (flags & HIO_VARIABLE && sc->sc_id_leds == id)
+			sc->sc_id_leds = led_id[2];
+		if (led_flags[2] & HIO_VARIABLE &&
+		    sc->sc_id_leds == led_id[2])
 			sc->sc_flags |= HKBD_FLAG_SCROLLLOCK;
 		DPRINTFN(1, "Found keyboard scrolllock\n");
 	}
 
 	if ((sc->sc_flags & (HKBD_FLAG_NUMLOCK | HKBD_FLAG_CAPSLOCK |
 	    HKBD_FLAG_SCROLLLOCK)) != 0)
-		sc->sc_led_size = hid_report_size_1(ptr, len,
-		    hid_output, sc->sc_id_leds);
+		sc->sc_led_size = hidx != NULL ?
+		    hid_index_report_size(hidx, hid_output, sc->sc_id_leds) :
+		    hid_report_size_1(ptr, len, hid_output, sc->sc_id_leds);
 }
 
 static int
@@ -915,7 +964,8 @@ hkbd_attach(device_t dev)
 		DPRINTF("Parsing HID descriptor of %d bytes\n",
 		    (int)hid_len);
 
-		hkbd_parse_hid(sc, hid_ptr, hid_len, tlc_index);
+		hkbd_parse_hid(sc, hid_ptr, hid_len,
+		    hidbus_get_report_descr(dev)->index, tlc_index);
 	}
 
 	/* check if we should use the boot protocol */
@@ -931,7 +981,12 @@ hkbd_attach(device_t dev)
 			    usbd_errstr(err));
 		}
 
-		hkbd_parse_hid(sc, hkbd_boot_desc, sizeof(hkbd_boot_desc), 0);
+		hkbd_parse_hid(sc, hkbd_boot_desc, sizeof(hkbd_boot_desc),
+		    NULL, 0);
+
+		/* Boot reports do not carry report ID. Receive them all. */
+		hidbus_set_flags(dev,
+		    hidbus_get_flags(dev) | HIDBUS_FLAG_ALL_REPORTS);
 	}
 
 	/* ignore if SETIDLE fails, hence it is not crucial */
@@ -66,6 +66,8 @@ __FBSDID("$FreeBSD$");
 
 /* HID report descriptor parser limit hardcoded in usbhid.h */
 #define	MAXUSAGE	64
+/* Maximal size of array range lookup table */
+#define	MAXARRRANGE	4096
 
 static device_probe_t hmap_probe;
 
@@ -141,133 +143,149 @@ hmap_ev_open(struct evdev_dev *evdev)
 	return (hidbus_intr_start(dev));
 }
 
-static void
-hmap_intr(void *context, void *buf, hid_size_t len)
+static bool
+hmap_intr_item(struct hmap_softc *sc, struct hmap_hid_item *hi, void *buf,
+    hid_size_t len)
 {
-	device_t dev = context;
-	struct hmap_softc *sc = device_get_softc(dev);
-	struct hmap_hid_item *hi;
 	const struct hmap_item *mi;
 	int32_t usage;
 	int32_t data;
 	uint16_t key, uoff;
-	uint8_t id = 0;
-	bool found, do_sync = false;
+	bool found;
 
-	mtx_assert(hidbus_get_lock(dev), MA_OWNED);
+	data = hid_cloc_get(&hi->cloc, buf, len);
 
-	/* Strip leading "report ID" byte */
-	if (sc->hid_items[0].id) {
-		id = *(uint8_t *)buf;
-		len--;
-		buf = (uint8_t *)buf + 1;
-	}
-
-	for (hi = sc->hid_items; hi < sc->hid_items + sc->nhid_items; hi++) {
-		/* Ignore irrelevant reports */
-		if (id != hi->id && hi->id != 0)
-			continue;
+	switch (hi->type) {
+	case HMAP_TYPE_CALLBACK:
+		if (hi->cb(sc, hi, data) != 0)
+			return (false);
+		break;
 
+	case HMAP_TYPE_VAR_NULLST:
 		/*
-		 * 5.8. If Logical Minimum and Logical Maximum are both
-		 * positive values then the contents of a field can be assumed
-		 * to be an unsigned value. Otherwise, all integer values are
-		 * signed values represented in 2’s complement format.
+		 * 5.10. If the host or the device receives an
+		 * out-of-range value then the current value for the
+		 * respective control will not be modified.
 		 */
-		data = hi->lmin < 0 || hi->lmax < 0
-		    ? hid_get_data(buf, len, &hi->loc)
-		    : hid_get_udata(buf, len, &hi->loc);
-
-		switch (hi->type) {
-		case HMAP_TYPE_CALLBACK:
-			if (hi->cb(sc, hi, data) != 0)
-				continue;
-			break;
-
-		case HMAP_TYPE_VAR_NULLST:
-			/*
-			 * 5.10. If the host or the device receives an
-			 * out-of-range value then the current value for the
-			 * respective control will not be modified.
-			 */
-			if (data < hi->lmin || data > hi->lmax)
-				continue;
-			/* FALLTROUGH */
-		case HMAP_TYPE_VARIABLE:
-			/*
-			 * Ignore reports for absolute data if the data did not
-			 * change and for relative data if data is 0.
-			 * Evdev layer filters out them anyway.
-			 */
-			if (data == (hi->evtype == EV_REL ? 0 : hi->last_val))
-				continue;
-			evdev_push_event(sc->evdev, hi->evtype,
-			    hi->code, data);
-			hi->last_val = data;
-			break;
+		if (data < hi->lmin || data > hi->lmax)
+			return (false);
+		/* FALLTROUGH */
+	case HMAP_TYPE_VARIABLE:
+		/*
+		 * Ignore reports for absolute data if the data did not
+		 * change and for relative data if data is 0.
+		 * Evdev layer filters out them anyway.
+		 */
+		if (data == (hi->evtype == EV_REL ? 0 : hi->last_val))
+			return (false);
+		evdev_push_event(sc->evdev, hi->evtype,
+		    hi->code, data);
+		hi->last_val = data;
+		break;
 
-		case HMAP_TYPE_ARR_LIST:
-			key = KEY_RESERVED;
-			/*
-			 * 6.2.2.5. An out-of range value in an array field
-			 * is considered no controls asserted.
-			 */
-			if (data < hi->lmin || data > hi->lmax)
-				goto report_key;
-			/*
-			 * 6.2.2.5. Rather than returning a single bit for each
-			 * button in the group, an array returns an index in
-			 * each field that corresponds to the pressed button.
-			 */
+	case HMAP_TYPE_ARR_LIST:
+		key = KEY_RESERVED;
+		/*
+		 * 6.2.2.5. An out-of range value in an array field
+		 * is considered no controls asserted.
+		 */
+		if (data < hi->lmin || data > hi->lmax)
+			goto report_key;
+		/*
+		 * 6.2.2.5. Rather than returning a single bit for each
+		 * button in the group, an array returns an index in
+		 * each field that corresponds to the pressed button.
+		 */
+		key = hi->codes[data - hi->lmin];
+		if (key == KEY_RESERVED)
+			DPRINTF(sc, "Can not map unknown HID "
+			    "array index: %08x\n", data);
+		goto report_key;
+
+	case HMAP_TYPE_ARR_RANGE:
+		key = KEY_RESERVED;
+		/*
+		 * 6.2.2.5. An out-of range value in an array field
+		 * is considered no controls asserted.
+		 */
+		if (data < hi->lmin || data > hi->lmax)
+			goto report_key;
+		/* Use precalculated lookup table if it is available */
+		if (hi->codes != NULL) {
 			key = hi->codes[data - hi->lmin];
 			if (key == KEY_RESERVED)
 				DPRINTF(sc, "Can not map unknown HID "
-				    "array index: %08x\n", data);
+				    "usage: %08x\n",
+				    data - hi->lmin + hi->umin);
 			goto report_key;
-
-		case HMAP_TYPE_ARR_RANGE:
-			key = KEY_RESERVED;
-			/*
-			 * 6.2.2.5. An out-of range value in an array field
-			 * is considered no controls asserted.
-			 */
-			if (data < hi->lmin || data > hi->lmax)
-				goto report_key;
-			/*
-			 * When the input field is an array and the usage is
-			 * specified with a range instead of an ID, we have to
-			 * derive the actual usage by using the item value as
-			 * an index in the usage range list.
-			 */
-			usage = data - hi->lmin + hi->umin;
-			found = false;
-			HMAP_FOREACH_ITEM(sc, mi, uoff) {
-				if (usage == mi->usage + uoff &&
-				    mi->type == EV_KEY && !mi->has_cb) {
-					key = mi->code;
-					found = true;
-					break;
-				}
+		}
+		/*
+		 * When the input field is an array and the usage is
+		 * specified with a range instead of an ID, we have to
+		 * derive the actual usage by using the item value as
+		 * an index in the usage range list.
+		 */
+		usage = data - hi->lmin + hi->umin;
+		found = false;
+		HMAP_FOREACH_ITEM(sc, mi, uoff) {
+			if (usage == mi->usage + uoff &&
+			    mi->type == EV_KEY && !mi->has_cb) {
+				key = mi->code + uoff;
+				found = true;
+				break;
 			}
-			if (!found)
-				DPRINTF(sc, "Can not map unknown HID "
-				    "usage: %08x\n", usage);
+		}
+		if (!found)
+			DPRINTF(sc, "Can not map unknown HID "
+			    "usage: %08x\n", usage);
 report_key:
-			if (key == HMAP_KEY_NULL || key == hi->last_key)
-				continue;
-			if (hi->last_key != KEY_RESERVED)
-				evdev_push_key(sc->evdev, hi->last_key, 0);
-			if (key != KEY_RESERVED)
-				evdev_push_key(sc->evdev, key, 1);
-			hi->last_key = key;
-			break;
+		if (key == HMAP_KEY_NULL || key == hi->last_key)
+			return (false);
+		if (hi->last_key != KEY_RESERVED)
+			evdev_push_key(sc->evdev, hi->last_key, 0);
+		if (key != KEY_RESERVED)
+			evdev_push_key(sc->evdev, key, 1);
+		hi->last_key = key;
+		break;
+
+	default:
+		KASSERT(0, ("Unknown map type (%d)", hi->type));
+	}
 
-		default:
-			KASSERT(0, ("Unknown map type (%d)", hi->type));
-		}
-		do_sync = true;
+	return (true);
+}
+
+static void
+hmap_intr(void *context, void *buf, hid_size_t len)
+{
+	device_t dev = context;
+	struct hmap_softc *sc = device_get_softc(dev);
+	struct hmap_hid_item *hi;
+	const uint32_t *idx;
+	uint32_t i;
+	uint8_t id = 0;
+	bool do_sync = false;
+
+	mtx_assert(hidbus_get_lock(dev), MA_OWNED);
+
+	/* Strip leading "report ID" byte */
+	if (sc->hid_items[0].id) {
+		id = *(uint8_t *)buf;
+		len--;
+		buf = (uint8_t *)buf + 1;
 	}
 
+	/* Process items carried by this report in report descriptor order */
+	idx = sc->rid_index + sc->rid_start[id];
+	for (i = 0; i < sc->rid_count[id]; i++)
+		do_sync |= hmap_intr_item(sc, sc->hid_items + idx[i], buf, len);
+
+	/* Completion callbacks are called for every report */
+	for (hi = sc->hid_items + sc->nparsed_items;
+	     hi < sc->hid_items + sc->nhid_items;
+	     hi++)
+		do_sync |= hmap_intr_item(sc, hi, buf, len);
+
 	if (do_sync)
 		evdev_sync(sc->evdev);
 }
@@ -321,7 +339,8 @@ static bool
 hmap_probe_hid_item(struct hid_item *hi, const struct hmap_item *map,
     int nmap_items, bitstr_t *caps)
 {
-	int32_t arr_size, usage;
+	int64_t arr_size;
+	int32_t usage;
 	u_int i, j;
 	uint16_t uoff;
 	bool found = false;
@@ -363,7 +382,7 @@ hmap_probe_hid_item(struct hid_item *hi, const struct hmap_item *map,
 		return (found);
 	}
 
-	arr_size = hi->logical_maximum - hi->logical_minimum + 1;
+	arr_size = (int64_t)hi->logical_maximum - hi->logical_minimum + 1;
 	if (arr_size < 1 || arr_size > MAXUSAGE)
 		return (false);
 	for (j = 0; j < arr_size; j++) {
@@ -485,7 +504,8 @@ hmap_parse_hid_item(struct hmap_softc *sc, struct hid_item *hi,
 {
 	const struct hmap_item *mi;
 	struct hmap_hid_item hi_temp;
-	int32_t arr_size, usage;
+	int64_t arr_size;
+	int32_t usage;
 	uint32_t i;
 	uint16_t uoff;
 	bool found = false;
@@ -549,13 +569,33 @@ hmap_parse_hid_item(struct hmap_softc *sc, struct hid_item *hi,
 		if (!found)
 			return (false);
 		item->umin = hi->usage_minimum;
+		/*
+		 * Translate every possible array index to evdev code once at
+		 * attach time to avoid map lookups in interrupt handler.
+		 */
+		arr_size = (int64_t)hi->logical_maximum -
+		    hi->logical_minimum + 1;
+		if (arr_size >= 1 && arr_size <= MAXARRRANGE) {
+			item->codes = malloc(arr_size * sizeof(uint16_t),
+			    M_DEVBUF, M_WAITOK | M_ZERO);
+			for (i = 0; i < arr_size; i++) {
+				usage = i + hi->usage_minimum;
+				HMAP_FOREACH_ITEM(sc, mi, uoff) {
+					if (usage != mi->usage + uoff ||
+					    mi->type != EV_KEY || mi->has_cb)
+						continue;
+					item->codes[i] = mi->code + uoff;
+					break;
+				}
+			}
+		}
 		item->type = HMAP_TYPE_ARR_RANGE;
 		item->last_key = KEY_RESERVED;
 		evdev_support_event(sc->evdev, EV_KEY);
 		goto mapped;
 	}
 
-	arr_size = hi->logical_maximum - hi->logical_minimum + 1;
+	arr_size = (int64_t)hi->logical_maximum - hi->logical_minimum + 1;
 	if (arr_size < 1 || arr_size > MAXUSAGE)
 		return (false);
 	for (i = 0; i < arr_size; i++) {
@@ -591,6 +631,14 @@ mapped:
 	item->loc = hi->loc;
 	item->lmin = hi->logical_minimum;
 	item->lmax = hi->logical_maximum;
+	/*
+	 * 5.8. If Logical Minimum and Logical Maximum are both
+	 * positive values then the contents of a field can be assumed
+	 * to be an unsigned value. Otherwise, all integer values are
+	 * signed values represented in 2’s complement format.
+	 */
+	hid_cloc_compile(&item->cloc, &hi->loc,
+	    item->lmin < 0 || item->lmax < 0);
 
 	return (true);
 }
@@ -604,7 +652,8 @@ hmap_parse_hid_descr(struct hmap_softc *sc, uint8_t tlc_index)
 	struct hmap_hid_item *item = sc->hid_items;
 	void *d_ptr;
 	hid_size_t d_len;
-	int i, error;
+	int i, id, error;
+	uint32_t n, nparsed, nindex;
 
 	error = hid_get_report_descr(sc->dev, &d_ptr, &d_len);
 	if (error != 0) {
@@ -627,6 +676,37 @@ hmap_parse_hid_descr(struct hmap_softc *sc, uint8_t tlc_index)
 	}
 	hid_end_parse(hd);
 
+	/*
+	 * Build lists of items carried by each report ID keeping report
+	 * descriptor order. Items stay in place as their state is shared
+	 * between the lists. Reports with IDs unknown to report descriptor
+	 * carry items without report ID only.
+	 */
+	nparsed = item - sc->hid_items;
+	memset(sc->rid_count, 0, sizeof(sc->rid_count));
+	for (i = 0; i < nparsed; i++)
+		sc->rid_count[sc->hid_items[i].id]++;
+	nindex = sc->rid_count[0];
+	for (id = 1; id < HMAP_NRIDS; id++)
+		if (sc->rid_count[id] != 0)
+			nindex += sc->rid_count[id] + sc->rid_count[0];
+	sc->rid_index = malloc(MAX(nindex, 1) * sizeof(uint32_t), M_DEVBUF,
+	    M_WAITOK);
+	for (id = 0, n = 0; id < HMAP_NRIDS; id++) {
+		if (id != 0 && sc->rid_count[id] == 0) {
+			sc->rid_start[id] = sc->rid_start[0];
+			sc->rid_count[id] = sc->rid_count[0];
+			continue;
+		}
+		sc->rid_start[id] = n;
+		for (i = 0; i < nparsed; i++)
+			if (sc->hid_items[i].id == id ||
+			    sc->hid_items[i].id == 0)
+				sc->rid_index[n++] = i;
+		sc->rid_count[id] = n - sc->rid_start[id];
+	}
+	sc->nparsed_items = nparsed;
+
 	/* Add completion callbacks to the end of list */
 	for (i = 0; i < sc->nmaps; i++) {
 		for (map = sc->map[i];
@@ -719,10 +799,12 @@ hmap_detach(device_t dev)
 		    hi++)
 			if (hi->type == HMAP_TYPE_CALLBACK)
 				hi->cb(sc, hi, 0);
-			else if (hi->type == HMAP_TYPE_ARR_LIST)
+			else if (hi->type == HMAP_TYPE_ARR_LIST ||
+			    hi->type == HMAP_TYPE_ARR_RANGE)
 				free(hi->codes, M_DEVBUF);
 		free(sc->hid_items, M_DEVBUF);
 	}
+	free(sc->rid_index, M_DEVBUF);
 
 	return (0);
 }
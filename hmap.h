@@ -34,6 +34,7 @@
 #include "hid.h"
 
 #define	HMAP_MAX_MAPS	4
+#define	HMAP_NRIDS	256	/* Number of distinct report IDs */
 
 struct hmap_hid_item;
 struct hmap_item;
@@ -143,11 +144,14 @@ struct hmap_hid_item {
 			uint16_t	evtype;	/* Evdev event type */
 			uint16_t	code;	/* Evdev event code */
 		};
-		uint16_t	*codes;		/* Array list map type */
-		int32_t		umin;		/* Array range map type */
+		struct {			/* Array list and range */
+			uint16_t	*codes;	/* Index to code lookup table */
+			int32_t		umin;	/* Usage minimum (range) */
+		};
 	};
 	uint8_t			id;		/* Report ID */
 	struct hid_location	loc;		/* HID item location */
+	struct hid_cloc		cloc;		/* Compiled HID item location */
 	int32_t			lmin;		/* HID item logical minimum */
 	int32_t			lmax;		/* HID item logical maximum */
 	union {
@@ -172,6 +176,17 @@ struct hmap_softc {
 	/* List of preparsed HID items */
 	uint32_t		nhid_items;
 	struct hmap_hid_item	*hid_items;
+	/*
+	 * Indices of hid_items carried by report with ID N are stored in
+	 * report descriptor order in rid_count[N] entries of rid_index array
+	 * starting from rid_start[N]. Items without report ID are relevant
+	 * to every report and are included in each list. Completion callbacks
+	 * start at hid_items[nparsed_items] and last up to the end of array.
+	 */
+	uint32_t		*rid_index;
+	uint32_t		rid_start[HMAP_NRIDS];
+	uint32_t		rid_count[HMAP_NRIDS];
+	uint32_t		nparsed_items;
 
 	int			*debug_var;
 	enum hmap_cb_state	cb_state;
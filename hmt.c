@@ -188,10 +188,10 @@ struct hmt_softc {
 	enum hmt_type		type;
 
 	struct hid_absinfo      ai[HMT_N_USAGES];
-	struct hid_location     locs[MAX_MT_SLOTS][HMT_N_USAGES];
-	struct hid_location     cont_count_loc;
-	struct hid_location	btn_loc[HMT_BTN_MAX];
-	struct hid_location	int_btn_loc;
+	struct hid_cloc		locs[MAX_MT_SLOTS][HMT_N_USAGES];
+	struct hid_cloc		cont_count_loc;
+	struct hid_cloc		btn_loc[HMT_BTN_MAX];
+	struct hid_cloc		int_btn_loc;
 
 	struct evdev_dev        *evdev;
 
@@ -199,6 +199,7 @@ struct hmt_softc {
 	bitstr_t		bit_decl(caps, HMT_N_USAGES);
 	bitstr_t		bit_decl(buttons, HMT_BTN_MAX);
 	uint32_t                isize;
+	bool			nocheck;	/* All locations fit in isize */
 	uint32_t                nconts_per_report;
 	uint32_t		nconts_todo;
 	uint8_t                 report_id;
@@ -217,7 +218,7 @@ struct hmt_softc {
 };
 
 static enum hmt_type hmt_hid_parse(struct hmt_softc *, const void *,
-    hid_size_t, uint32_t, uint8_t);
+    hid_size_t, const struct hid_index *, uint32_t, uint8_t);
 static int hmt_set_input_mode(struct hmt_softc *, enum hconf_input_mode);
 
 static hid_intr_t		hmt_intr;
@@ -298,6 +299,7 @@ hmt_probe(device_t dev)
 	/* Check if report descriptor belongs to a HID multitouch device */
 	if (sc->type == HMT_TYPE_UNKNOWN)
 		sc->type = hmt_hid_parse(sc, d_ptr, d_len,
+		    hidbus_get_report_descr(dev)->index,
 		    hidbus_get_usage(dev), hidbus_get_index(dev));
 	if (sc->type == HMT_TYPE_UNSUPPORTED)
 		return (ENXIO);
@@ -314,10 +316,12 @@ hmt_attach(device_t dev)
 	struct hmt_softc *sc = device_get_softc(dev);
 	const struct hid_device_info *hw = hid_get_device_info(dev);
 	void *d_ptr;
+	struct hid_report_req reqs[3];
 	uint8_t *fbuf = NULL;
 	hid_size_t d_len, fsize;
 	uint32_t cont_count_max;
 	int nbuttons, btn;
+	int cont_req = -1, btn_req = -1, nreqs = 0;
 	size_t i;
 	int error;
 
@@ -330,16 +334,59 @@ hmt_attach(device_t dev)
 
 	sc->dev = dev;
 
-	fsize = hid_report_size(d_ptr, d_len, hid_feature, NULL);
+	fsize = hid_index_report_size_max(hidbus_get_report_descr(dev)->index,
+	    hid_feature, NULL);
 	if (fsize != 0)
-		fbuf = malloc(fsize, M_TEMP, M_WAITOK | M_ZERO);
+		fbuf = malloc(fsize * nitems(reqs), M_TEMP, M_WAITOK | M_ZERO);
 
-	/* Fetch and parse "Contact count maximum" feature report */
+	/*
+	 * Feature reports are fetched with single batch request to let
+	 * transport backend issue them back to back.
+	 */
 	if (sc->cont_max_rlen > 1) {
-		error = hid_get_report(dev, fbuf, sc->cont_max_rlen, NULL,
-		    HID_FEATURE_REPORT, sc->cont_max_rid);
-		if (error == 0) {
-			cont_count_max = hid_get_udata(fbuf + 1,
+		cont_req = nreqs++;
+		reqs[cont_req] = (struct hid_report_req) {
+			.data = fbuf + cont_req * fsize,
+			.len = sc->cont_max_rlen,
+			.type = HID_FEATURE_REPORT,
+			.id = sc->cont_max_rid,
+		};
+	} else
+		DPRINTF("Feature report %hhu size invalid: %u\n",
+		    sc->cont_max_rid, sc->cont_max_rlen);
+
+	if (sc->btn_type_rlen > 1 && sc->btn_type_rid == sc->cont_max_rid &&
+	    cont_req >= 0)
+		btn_req = cont_req;
+	else if (sc->btn_type_rlen > 1) {
+		btn_req = nreqs++;
+		reqs[btn_req] = (struct hid_report_req) {
+			.data = fbuf + btn_req * fsize,
+			.len = sc->btn_type_rlen,
+			.type = HID_FEATURE_REPORT,
+			.id = sc->btn_type_rid,
+		};
+	}
+
+	/* Fetch THQA certificate to enable some devices like WaveShare */
+	if (sc->thqa_cert_rlen > 1 && sc->thqa_cert_rid != sc->cont_max_rid) {
+		reqs[nreqs] = (struct hid_report_req) {
+			.data = fbuf + nreqs * fsize,
+			.len = sc->thqa_cert_rlen,
+			.type = HID_FEATURE_REPORT,
+			.id = sc->thqa_cert_rid,
+		};
+		nreqs++;
+	}
+
+	if (nreqs > 0)
+		(void)hid_batch_report(dev, reqs, nreqs);
+
+	/* Parse "Contact count maximum" feature report */
+	if (cont_req >= 0) {
+		if (reqs[cont_req].error == 0) {
+			cont_count_max = hid_get_udata(
+			    (uint8_t *)reqs[cont_req].data + 1,
 			    sc->cont_max_rlen - 1, &sc->cont_max_loc);
 			/*
 			 * Feature report is a primary source of
@@ -348,30 +395,21 @@ hmt_attach(device_t dev)
 			if (cont_count_max > 0)
 				sc->ai[HMT_SLOT].max = cont_count_max - 1;
 		} else
-			DPRINTF("usbd_req_get_report error=%d\n", error);
-	} else
-		DPRINTF("Feature report %hhu size invalid: %u\n",
-		    sc->cont_max_rid, sc->cont_max_rlen);
-
-	/* Fetch and parse "Button type" feature report */
-	if (sc->btn_type_rlen > 1 && sc->btn_type_rid != sc->cont_max_rid) {
-		bzero(fbuf, fsize);
-		error = hid_get_report(dev, fbuf, sc->btn_type_rlen, NULL,
-		    HID_FEATURE_REPORT, sc->btn_type_rid);
+			DPRINTF("usbd_req_get_report error=%d\n",
+			    reqs[cont_req].error);
 	}
-	if (sc->btn_type_rlen > 1) {
-		if (error == 0)
-			sc->is_clickpad = hid_get_udata(fbuf + 1,
+
+	/* Parse "Button type" feature report */
+	if (btn_req >= 0) {
+		if (reqs[btn_req].error == 0)
+			sc->is_clickpad = hid_get_udata(
+			    (uint8_t *)reqs[btn_req].data + 1,
 			    sc->btn_type_rlen - 1, &sc->btn_type_loc) == 0;
 		else
-			DPRINTF("usbd_req_get_report error=%d\n", error);
+			DPRINTF("usbd_req_get_report error=%d\n",
+			    reqs[btn_req].error);
 	}
 
-	/* Fetch THQA certificate to enable some devices like WaveShare */
-	if (sc->thqa_cert_rlen > 1 && sc->thqa_cert_rid != sc->cont_max_rid)
-		(void)hid_get_report(dev, fbuf, sc->thqa_cert_rlen, NULL,
-		    HID_FEATURE_REPORT, sc->thqa_cert_rid);
-
 	free(fbuf, M_TEMP);
 
 	/* Switch touchpad in to absolute multitouch mode */
@@ -462,6 +500,16 @@ hmt_detach(device_t dev)
 	return (0);
 }
 
+static inline uint32_t
+hmt_get_data(struct hmt_softc *sc, const uint8_t *buf, hid_size_t len,
+    const struct hid_cloc *cl)
+{
+
+	if (sc->nocheck)
+		return (hid_cloc_get_nocheck(cl, buf));
+	return (hid_cloc_get(cl, buf, len));
+}
+
 static void
 hmt_intr(void *context, void *buf, hid_size_t len)
 {
@@ -521,7 +569,7 @@ hmt_intr(void *context, void *buf, hid_size_t len)
 	 * report with contactid=0 but contactids are zero-based, find
 	 * contactcount first.
 	 */
-	cont_count = hid_get_udata(buf, len, &sc->cont_count_loc);
+	cont_count = hmt_get_data(sc, buf, len, &sc->cont_count_loc);
 	/*
 	 * "In Hybrid mode, the number of contacts that can be reported in one
 	 * report is less than the maximum number of contacts that the device
@@ -558,8 +606,8 @@ hmt_intr(void *context, void *buf, hid_size_t len)
 
 		bzero(slot_data, sizeof(sc->slot_data));
 		HMT_FOREACH_USAGE(sc->caps, usage) {
-			if (sc->locs[cont][usage].size > 0)
-				slot_data[usage] = hid_get_udata(
+			if (sc->locs[cont][usage].nbytes > 0)
+				slot_data[usage] = hmt_get_data(sc,
 				    buf, len, &sc->locs[cont][usage]);
 		}
 
@@ -611,9 +659,9 @@ hmt_intr(void *context, void *buf, hid_size_t len)
 	if (sc->nconts_todo == 0) {
 		/* Report both the click and external left btns as BTN_LEFT */
 		if (sc->has_int_button)
-			int_btn = hid_get_data(buf, len, &sc->int_btn_loc);
+			int_btn = hmt_get_data(sc, buf, len, &sc->int_btn_loc);
 		if (sc->max_button != 0 && bit_test(sc->buttons, 0))
-			left_btn = hid_get_data(buf, len, &sc->btn_loc[0]);
+			left_btn = hmt_get_data(sc, buf, len, &sc->btn_loc[0]);
 		if (sc->has_int_button ||
 		    (sc->max_button != 0 && bit_test(sc->buttons, 0)))
 			evdev_push_key(sc->evdev, BTN_LEFT,
@@ -621,9 +669,8 @@ hmt_intr(void *context, void *buf, hid_size_t len)
 		for (btn = 1; btn < sc->max_button; ++btn) {
 			if (bit_test(sc->buttons, btn))
 				evdev_push_key(sc->evdev, BTN_MOUSE + btn,
-				    hid_get_data(buf,
-						 len,
-						 &sc->btn_loc[btn]) != 0);
+				    hmt_get_data(sc, buf, len,
+				    &sc->btn_loc[btn]) != 0);
 		}
 		evdev_sync(sc->evdev);
 	}
@@ -631,7 +678,7 @@ hmt_intr(void *context, void *buf, hid_size_t len)
 
 static enum hmt_type
 hmt_hid_parse(struct hmt_softc *sc, const void *d_ptr, hid_size_t d_len,
-    uint32_t tlc_usage, uint8_t tlc_index)
+    const struct hid_index *hidx, uint32_t tlc_usage, uint8_t tlc_index)
 {
 	struct hid_absinfo ai;
 	struct hid_item hi;
@@ -642,6 +689,7 @@ hmt_hid_parse(struct hmt_softc *sc, const void *d_ptr, hid_size_t d_len,
 	enum hmt_type type;
 	uint32_t left_btn, btn;
 	int32_t cont_count_max = 0;
+	hid_size_t cloc_end = 0;
 	uint8_t report_id = 0;
 	bool finger_coll = false;
 	bool cont_count_found = false;
@@ -678,7 +726,7 @@ hmt_hid_parse(struct hmt_softc *sc, const void *d_ptr, hid_size_t d_len,
 	}
 
 	/* Parse features for mandatory maximum contact count usage */
-	if (!hid_tlc_locate(d_ptr, d_len,
+	if (!hid_index_locate(hidx,
 	    HID_USAGE2(HUP_DIGITIZERS, HUD_CONTACT_MAX), hid_feature,
 	    tlc_index, 0, &sc->cont_max_loc, &flags, &sc->cont_max_rid, &ai) ||
 	    (flags & (HIO_VARIABLE | HIO_RELATIVE)) != HIO_VARIABLE)
@@ -687,14 +735,14 @@ hmt_hid_parse(struct hmt_softc *sc, const void *d_ptr, hid_size_t d_len,
 	cont_count_max = ai.max;
 
 	/* Parse features for button type usage */
-	if (hid_tlc_locate(d_ptr, d_len,
+	if (hid_index_locate(hidx,
 	    HID_USAGE2(HUP_DIGITIZERS, HUD_BUTTON_TYPE), hid_feature,
 	    tlc_index, 0, &sc->btn_type_loc, &flags, &sc->btn_type_rid, NULL)
 	    && (flags & (HIO_VARIABLE | HIO_RELATIVE)) != HIO_VARIABLE)
 		sc->btn_type_rid = 0;
 
 	/* Parse features for THQA certificate report ID */
-	hid_tlc_locate(d_ptr, d_len, HID_USAGE2(HUP_MICROSOFT, HUMS_THQA_CERT),
+	hid_index_locate(hidx, HID_USAGE2(HUP_MICROSOFT, HUMS_THQA_CERT),
 	    hid_feature, tlc_index, 0, NULL, NULL, &sc->thqa_cert_rid, NULL);
 
 	/* Parse input for other parameters */
@@ -725,7 +773,10 @@ hmt_hid_parse(struct hmt_softc *sc, const void *d_ptr, hid_size_t d_len,
 			if (hi.collevel == 1 && left_btn == 2 &&
 			    hi.usage == HID_USAGE2(HUP_BUTTON, 1)) {
 				has_int_button = true;
-				sc->int_btn_loc = hi.loc;
+				hid_cloc_compile(&sc->int_btn_loc, &hi.loc,
+				    true);
+				cloc_end = MAX(cloc_end,
+				    hid_cloc_end(&sc->int_btn_loc));
 				break;
 			}
 			if (hi.collevel == 1 &&
@@ -733,7 +784,10 @@ hmt_hid_parse(struct hmt_softc *sc, const void *d_ptr, hid_size_t d_len,
 			    hi.usage <= HID_USAGE2(HUP_BUTTON, HMT_BTN_MAX)) {
 				btn = (hi.usage & 0xFFFF) - left_btn;
 				bit_set(sc->buttons, btn);
-				sc->btn_loc[btn] = hi.loc;
+				hid_cloc_compile(&sc->btn_loc[btn], &hi.loc,
+				    true);
+				cloc_end = MAX(cloc_end,
+				    hid_cloc_end(&sc->btn_loc[btn]));
 				if (btn >= sc->max_button)
 					sc->max_button = btn + 1;
 				break;
@@ -741,7 +795,10 @@ hmt_hid_parse(struct hmt_softc *sc, const void *d_ptr, hid_size_t d_len,
 			if (hi.collevel == 1 && hi.usage ==
 			    HID_USAGE2(HUP_DIGITIZERS, HUD_CONTACTCOUNT)) {
 				cont_count_found = true;
-				sc->cont_count_loc = hi.loc;
+				hid_cloc_compile(&sc->cont_count_loc, &hi.loc,
+				    false);
+				cloc_end = MAX(cloc_end,
+				    hid_cloc_end(&sc->cont_count_loc));
 				break;
 			}
 			/* Scan time is required but clobbered by evdev */
@@ -766,9 +823,12 @@ hmt_hid_parse(struct hmt_softc *sc, const void *d_ptr, hid_size_t d_len,
 					 * events. So don`t stop search if we
 					 * already have HUG_X mapping done.
 					 */
-					if (sc->locs[cont][i].size)
+					if (sc->locs[cont][i].nbytes)
 						continue;
-					sc->locs[cont][i] = hi.loc;
+					hid_cloc_compile(&sc->locs[cont][i],
+					    &hi.loc, false);
+					cloc_end = MAX(cloc_end,
+					    hid_cloc_end(&sc->locs[cont][i]));
 					/*
 					 * Hid parser returns valid logical and
 					 * physical sizes for first finger only
@@ -826,14 +886,19 @@ hmt_hid_parse(struct hmt_softc *sc, const void *d_ptr, hid_size_t d_len,
 		sc->ai[HMT_ORIENTATION].max = 1;
 	}
 
-	sc->isize = hid_report_size_1(d_ptr, d_len, hid_input, report_id);
-	sc->cont_max_rlen = hid_report_size_1(d_ptr, d_len, hid_feature,
+	sc->isize = hid_index_report_size(hidx, hid_input, report_id);
+	/*
+	 * Input reports are zero-padded up to isize in hmt_intr() so bounds
+	 * checking can be skipped if all the locations fit in to isize.
+	 */
+	sc->nocheck = cloc_end + (report_id != 0) <= sc->isize;
+	sc->cont_max_rlen = hid_index_report_size(hidx, hid_feature,
 	    sc->cont_max_rid);
 	if (sc->btn_type_rid > 0)
-		sc->btn_type_rlen = hid_report_size_1(d_ptr, d_len,
+		sc->btn_type_rlen = hid_index_report_size(hidx,
 		    hid_feature, sc->btn_type_rid);
 	if (sc->thqa_cert_rid > 0)
-		sc->thqa_cert_rlen = hid_report_size_1(d_ptr, d_len,
+		sc->thqa_cert_rlen = hid_index_report_size(hidx,
 		    hid_feature, sc->thqa_cert_rid);
 
 	sc->report_id = report_id;
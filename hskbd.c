@@ -295,6 +295,7 @@ hskbd_attach(device_t dev)
 	uint32_t flags;
 	uint8_t id;
 	uint8_t tlc_index = hidbus_get_index(dev);
+	const struct hid_index *hidx = hidbus_get_report_descr(dev)->index;
 
 	/*
 	 * Set the report (non-boot) protocol if report descriptor has not been
@@ -309,14 +310,14 @@ hskbd_attach(device_t dev)
 	(void)hid_set_protocol(dev, set_report_proto ? 1 : 0);
 
 	/* figure out leds on keyboard */
-	if (hid_tlc_locate(d_ptr, d_len, HID_USAGE2(HUP_LEDS, 0x01),
+	if (hid_index_locate(hidx, HID_USAGE2(HUP_LEDS, 0x01),
 	    hid_output, tlc_index, 0, &sc->sc_loc_numlock, &flags,
 	    &sc->sc_id_leds, NULL)) {
 		if (flags & HIO_VARIABLE)
 			sc->sc_numlock_exists = true;
 		DPRINTFN(1, "Found keyboard numlock\n");
 	}
-	if (hid_tlc_locate(d_ptr, d_len, HID_USAGE2(HUP_LEDS, 0x02),
+	if (hid_index_locate(hidx, HID_USAGE2(HUP_LEDS, 0x02),
 	    hid_output, tlc_index, 0, &sc->sc_loc_capslock, &flags,
 	    &id, NULL)) {
 		if (!sc->sc_numlock_exists)
@@ -325,7 +326,7 @@ hskbd_attach(device_t dev)
 			sc->sc_capslock_exists = true;
 		DPRINTFN(1, "Found keyboard capslock\n");
 	}
-	if (hid_tlc_locate(d_ptr, d_len, HID_USAGE2(HUP_LEDS, 0x03),
+	if (hid_index_locate(hidx, HID_USAGE2(HUP_LEDS, 0x03),
 	    hid_output, tlc_index, 0, &sc->sc_loc_scrolllock, &flags,
 	    &id, NULL)) {
 		if (!sc->sc_numlock_exists && !sc->sc_capslock_exists)
@@ -337,7 +338,7 @@ hskbd_attach(device_t dev)
 
 	if (sc->sc_numlock_exists || sc->sc_capslock_exists ||
 	    sc->sc_scrolllock_exists)
-		sc->sc_led_size = hid_report_size_1(d_ptr, d_len,
+		sc->sc_led_size = hid_index_report_size(hidx,
 		    hid_output, sc->sc_id_leds);
 
 	return (hmap_attach(dev));
@@ -31,16 +31,19 @@ __FBSDID("$FreeBSD$");
 #include <sys/bus.h>
 #include <sys/callout.h>
 #include <sys/endian.h>
+#include <sys/hash.h>
 #include <sys/kernel.h>
 #include <sys/lock.h>
 #include <sys/malloc.h>
 #include <sys/module.h>
 #include <sys/mutex.h>
 #include <sys/rman.h>
+#include <sys/sbuf.h>
 #include <sys/sysctl.h>
 #include <sys/systm.h>
 #include <sys/sx.h>
 #include <sys/taskqueue.h>
+#include <sys/time.h>
 
 #include <machine/resource.h>
 
@@ -105,12 +108,57 @@ struct iichid_softc {
 	uint16_t		addr;	/* Shifted left by 1 */
 	uint16_t		config_reg;
 	struct i2c_hid_desc	desc;
+	void			*rdesc;		/* Cached report descriptor */
+	iichid_size_t		rdesc_len;
+	uint32_t		rdesc_hash;
 
 	hid_intr_t		*intr_handler;
 	void			*intr_ctx;
 	struct mtx		*intr_mtx;
-	uint8_t			*intr_buf;
 	iichid_size_t		intr_bufsize;
+	const struct hid_index	*intr_index;	/* iicbus lock */
+
+	/*
+	 * Ring of input report buffers. Each slot holds 2 bytes of length
+	 * header followed by report body. Slots in [head, head + count) are
+	 * owned by ring_task, the slot after them is filled by the reader
+	 * and extra slot past ring_depth receives reports read on overrun.
+	 * Buffers exist only between intr_setup and intr_unsetup while worker
+	 * thread runs since attach, so they are published under ring_mtx.
+	 */
+	struct mtx		ring_mtx;
+	struct task		ring_task;
+	uint8_t			*ring_buf;
+	iichid_size_t		*ring_len;
+	sbintime_t		*ring_time;	/* report arrival time */
+	int			ring_depth;
+	int			ring_head;	/* ring_mtx */
+	int			ring_count;	/* ring_mtx */
+	int			ring_count_max;
+	uint64_t		stat_overruns;
+	/* Idle notification which did not fit in full ring, ring_mtx */
+	bool			ring_idle;
+	int			ring_idle_slot;	/* delivered after this slot */
+	sbintime_t		ring_idle_time;
+	uint8_t			*poll_buf;	/* polled mode report buffer */
+
+	bool			single_read;	/* iicbus lock */
+	int			single_read_errors;
+	uint64_t		stat_reads_single;
+	uint64_t		stat_reads_split;
+	uint64_t		stat_xfers;
+
+	/* Statistics, protected by iicbus lock unless noted */
+	uint64_t		stat_intrs;		/* ithread */
+	uint64_t		stat_reads;
+	uint64_t		stat_empty_reads;
+	uint64_t		stat_long_reports;
+	uint64_t		stat_big_reports;
+	uint64_t		stat_short_reports;
+	uint64_t		stat_bus_failures;	/* unlocked */
+	uint64_t		stat_read_errors;
+	uint64_t		stat_bus_wait[IICHID_HIST_BUCKETS];
+	uint64_t		stat_xfer_time[IICHID_HIST_BUCKETS];
 
 	int			irq_rid;
 	struct resource		*irq_res;
@@ -120,20 +168,51 @@ struct iichid_softc {
 	int			sampling_rate_slow;
 	int			sampling_rate_fast;
 	int			sampling_hysteresis;
+	int			sampling_precision;	/* usec */
 	int			missing_samples;
 	struct timeout_task	periodic_task;
+	sbintime_t		sampling_deadline;	/* 0 if not armed */
+	bool			sampling_adaptive;
+	bool			sampling_idle;
+	sbintime_t		sampling_period;	/* Learned period */
+	sbintime_t		sampling_anchor;	/* Last report time */
+	sbintime_t		sampling_empty;		/* Last empty poll */
+	uint64_t		stat_wakeups;
+	uint64_t		stat_lateness;		/* usec, total */
+	uint64_t		stat_lateness_max;	/* usec */
 	bool			callout_setup;
 #endif
 
 	struct taskqueue	*taskqueue;
 	struct task		event_task;
 	struct task		power_task;
+	struct task		resume_task;
 
 	bool			open;		/* intr_mtx */
+	bool			dying;		/* intr_mtx */
 	bool			suspend;	/* iicbus lock */
 	bool			power_on;	/* iicbus lock */
 };
 
+/*
+ * All devices residing on the same iicbus share single worker thread as
+ * they can not access the bus concurrently anyway.
+ */
+struct iichid_worker {
+	device_t		bus;
+	struct taskqueue	*taskqueue;
+	int			refs;
+	LIST_ENTRY(iichid_worker) link;
+};
+
+static LIST_HEAD(, iichid_worker) iichid_workers =
+    LIST_HEAD_INITIALIZER(iichid_workers);
+static struct sx iichid_workers_lock;
+SX_SYSINIT(iichid_workers, &iichid_workers_lock, "iichid workers");
+
+#define	IICHID_RING_SLOT(sc, n)	\
+	((sc)->ring_buf + (n) * ((sc)->intr_bufsize + 2))
+
 #ifdef IICHID_SAMPLING
 static int	iichid_setup_callout(struct iichid_softc *);
 static int	iichid_reset_callout(struct iichid_softc *);
@@ -269,6 +348,63 @@ iichid_get_handle(device_t dev)
 }
 #endif /* HAVE_ACPI_IICBUS */
 
+static struct taskqueue *
+iichid_worker_get(device_t bus)
+{
+	struct iichid_worker *w;
+
+	sx_xlock(&iichid_workers_lock);
+	LIST_FOREACH(w, &iichid_workers, link)
+		if (w->bus == bus)
+			break;
+	if (w == NULL) {
+		w = malloc(sizeof(*w), M_DEVBUF, M_WAITOK | M_ZERO);
+		w->bus = bus;
+		/* taskqueue_create can't fail with M_WAITOK mflag passed */
+		w->taskqueue = taskqueue_create("iichid_tq", M_WAITOK,
+		    taskqueue_thread_enqueue, &w->taskqueue);
+		taskqueue_start_threads(&w->taskqueue, 1, PI_TTY,
+		    "%s iichid taskq", device_get_nameunit(bus));
+		LIST_INSERT_HEAD(&iichid_workers, w, link);
+	}
+	w->refs++;
+	sx_xunlock(&iichid_workers_lock);
+
+	return (w->taskqueue);
+}
+
+static void
+iichid_worker_put(device_t bus)
+{
+	struct iichid_worker *w;
+
+	sx_xlock(&iichid_workers_lock);
+	LIST_FOREACH(w, &iichid_workers, link)
+		if (w->bus == bus)
+			break;
+	KASSERT(w != NULL, ("iichid worker for %s not found",
+	    device_get_nameunit(bus)));
+	if (--w->refs == 0) {
+		LIST_REMOVE(w, link);
+		taskqueue_free(w->taskqueue);
+		free(w, M_DEVBUF);
+	}
+	sx_xunlock(&iichid_workers_lock);
+}
+
+static void
+iichid_drain_tasks(struct iichid_softc *sc)
+{
+
+#ifdef IICHID_SAMPLING
+	taskqueue_drain_timeout(sc->taskqueue, &sc->periodic_task);
+#endif
+	taskqueue_drain(sc->taskqueue, &sc->event_task);
+	taskqueue_drain(sc->taskqueue, &sc->power_task);
+	taskqueue_drain(sc->taskqueue, &sc->resume_task);
+	taskqueue_drain(taskqueue_swi, &sc->ring_task);
+}
+
 static int
 iichid_cmd_read(struct iichid_softc* sc, void *buf, iichid_size_t maxlen,
     iichid_size_t *actual_len)
@@ -286,6 +422,7 @@ iichid_cmd_read(struct iichid_softc* sc, void *buf, iichid_size_t maxlen,
 	int error;
 
 	error = iicbus_transfer(sc->dev, msgs, nitems(msgs));
+	sc->stat_xfers++;
 	if (error != 0)
 		return (error);
 
@@ -300,6 +437,7 @@ iichid_cmd_read(struct iichid_softc* sc, void *buf, iichid_size_t maxlen,
 		if (actlen > maxlen) {
 			DPRINTF(sc, "input report too big. requested=%d "
 			    "received=%d\n", maxlen, actlen);
+			sc->stat_big_reports++;
 			actlen = maxlen;
 		}
 		/* Read input report itself */
@@ -308,6 +446,7 @@ iichid_cmd_read(struct iichid_softc* sc, void *buf, iichid_size_t maxlen,
 	}
 
 	error = iicbus_transfer(sc->dev, msgs, 1);
+	sc->stat_xfers++;
 	if (error == 0 && actual_len != NULL)
 		*actual_len = actlen;
 
@@ -317,6 +456,281 @@ iichid_cmd_read(struct iichid_softc* sc, void *buf, iichid_size_t maxlen,
 	return (error);
 }
 
+static int
+iichid_cmd_read_single(struct iichid_softc *sc, uint8_t *rdbuf,
+    iichid_size_t maxlen, iichid_size_t *actual_len)
+{
+	/*
+	 * Read length header and input report with single transfer assuming
+	 * that report is not longer than wMaxInputLength. Report body lands
+	 * right after the header.
+	 */
+	uint16_t maxin = le16toh(sc->desc.wMaxInputLength);
+	iichid_size_t rdlen;
+	struct iic_msg msgs[1];
+	uint16_t actlen;
+	int error;
+
+	rdlen = maxin > 2 ? MIN(maxlen, maxin - 2) : maxlen;
+	msgs[0] = (struct iic_msg)
+	    { sc->addr, IIC_M_RD, 2 + rdlen, rdbuf };
+
+	error = iicbus_transfer(sc->dev, msgs, 1);
+	sc->stat_xfers++;
+	if (error != 0)
+		return (error);
+
+	actlen = le16dec(rdbuf);
+	if (actlen <= 2 || actlen == 0xFFFF || maxlen == 0) {
+		actlen = 0;
+	} else {
+		actlen -= 2;
+		if (actlen > rdlen) {
+			/* Tail of report is lost if wMaxInputLength is wrong */
+			if (rdlen < maxlen) {
+				sc->stat_long_reports++;
+				return (IIC_EOVERFLOW);
+			}
+			DPRINTF(sc, "input report too big. requested=%d "
+			    "received=%d\n", maxlen, actlen);
+			sc->stat_big_reports++;
+			actlen = maxlen;
+		}
+	}
+
+	if (actual_len != NULL)
+		*actual_len = actlen;
+
+	DPRINTFN(sc, 5, "%*D - %*D\n", 2, rdbuf, " ", actlen, rdbuf + 2, " ");
+
+	return (0);
+}
+
+static void
+iichid_hist_add(uint64_t *hist, sbintime_t sbt)
+{
+
+	hist[MIN(flsll(sbttous(sbt)), IICHID_HIST_BUCKETS - 1)]++;
+}
+
+/*
+ * Check input report length against one described by report descriptor.
+ * hidbus accepts short reports but they point to device or descriptor bugs.
+ */
+static bool
+iichid_report_is_short(struct iichid_softc *sc, const uint8_t *buf,
+    iichid_size_t len)
+{
+	int size;
+
+	if (sc->intr_index == NULL || len == 0)
+		return (false);
+
+	size = hid_index_report_size(sc->intr_index, hid_input, 0);
+	if (size == 0)
+		size = hid_index_report_size(sc->intr_index, hid_input,
+		    buf[0]);
+
+	return (len < size);
+}
+
+/*
+ * Fetch input report into ring slot. Must be called with iicbus acquired.
+ */
+static int
+iichid_intr_read(struct iichid_softc *sc, uint8_t *rdbuf, iichid_size_t maxlen,
+    iichid_size_t *actual_len)
+{
+	sbintime_t start = sbinuptime();
+	int error;
+
+	sc->stat_reads++;
+	if (!sc->single_read) {
+		error = iichid_cmd_read(sc, rdbuf + 2, maxlen, actual_len);
+		if (error == 0)
+			sc->stat_reads_split++;
+		goto done;
+	}
+
+	error = iichid_cmd_read_single(sc, rdbuf, maxlen, actual_len);
+	if (error == 0) {
+		sc->single_read_errors = 0;
+		sc->stat_reads_single++;
+		goto done;
+	}
+
+	if (error == IIC_EOVERFLOW ||
+	    ++sc->single_read_errors >= IICHID_SINGLE_READ_ERRORS) {
+		device_printf(sc->dev, "single transfer read failed: %d. "
+		    "Fallback to split reads\n", error);
+		sc->single_read = false;
+		sc->single_read_errors = 0;
+	}
+
+done:
+	iichid_hist_add(sc->stat_xfer_time, sbinuptime() - start);
+	if (error != 0)
+		sc->stat_read_errors++;
+	else if (*actual_len == 0 && maxlen != 0)
+		sc->stat_empty_reads++;
+	else if (maxlen != 0 &&
+	    iichid_report_is_short(sc, rdbuf + 2, *actual_len))
+		sc->stat_short_reports++;
+
+	return (error);
+}
+
+/*
+ * Queue report to be passed to hidbus by ring_task. Zero length report is
+ * queued too as it carries idle notification.
+ */
+static void
+iichid_ring_commit(struct iichid_softc *sc, int slot, iichid_size_t len)
+{
+
+	mtx_lock(&sc->ring_mtx);
+	if (sc->ring_buf == NULL || slot < 0) {
+		mtx_unlock(&sc->ring_mtx);
+		return;
+	}
+	if (slot == sc->ring_depth) {
+		sc->stat_overruns++;
+		mtx_unlock(&sc->ring_mtx);
+		return;
+	}
+	sc->ring_len[slot] = len;
+	sc->ring_time[slot] = sbinuptime();
+	sc->ring_count++;
+	if (sc->ring_count > sc->ring_count_max)
+		sc->ring_count_max = sc->ring_count;
+	mtx_unlock(&sc->ring_mtx);
+
+	taskqueue_enqueue(taskqueue_swi, &sc->ring_task);
+}
+
+static int
+iichid_ring_tail(struct iichid_softc *sc)
+{
+	int slot;
+
+	mtx_lock(&sc->ring_mtx);
+	if (sc->ring_buf == NULL)
+		slot = -1;
+	else if (sc->ring_count == sc->ring_depth)
+		slot = sc->ring_depth;
+	else
+		slot = (sc->ring_head + sc->ring_count) % sc->ring_depth;
+	mtx_unlock(&sc->ring_mtx);
+
+	return (slot);
+}
+
+#ifdef IICHID_SAMPLING
+/*
+ * Queue idle notification. If the ring is full it is attached to the last
+ * queued report rather than dropped as overrun. Tail slot is safe to use
+ * as interrupts are disabled in sampling mode so the caller is the only
+ * reader.
+ */
+static void
+iichid_ring_idle(struct iichid_softc *sc)
+{
+	int slot;
+
+	mtx_lock(&sc->ring_mtx);
+	if (sc->ring_buf == NULL) {
+		mtx_unlock(&sc->ring_mtx);
+		return;
+	}
+	if (sc->ring_count == sc->ring_depth) {
+		sc->ring_idle = true;
+		sc->ring_idle_slot = (sc->ring_head + sc->ring_count - 1) %
+		    sc->ring_depth;
+		sc->ring_idle_time = sbinuptime();
+		mtx_unlock(&sc->ring_mtx);
+		return;
+	}
+	slot = (sc->ring_head + sc->ring_count) % sc->ring_depth;
+	mtx_unlock(&sc->ring_mtx);
+
+	iichid_ring_commit(sc, slot, 0);
+}
+#endif
+
+/*
+ * Read input report into the ring. Must be called with iicbus acquired so
+ * tail slot can not be taken by other reader until report is committed.
+ * intr_mtx is not required so I2C transfer may run in parallel with
+ * processing of previous reports.
+ */
+static int
+iichid_ring_read(struct iichid_softc *sc, iichid_size_t maxlen,
+    iichid_size_t *actual_len)
+{
+	uint8_t hdr[2];
+	int error, slot;
+
+	slot = iichid_ring_tail(sc);
+	/* No ring yet or anymore. Only acknowledge the interrupt */
+	if (slot < 0)
+		return (iichid_intr_read(sc, hdr, 0, actual_len));
+	error = iichid_intr_read(sc, IICHID_RING_SLOT(sc, slot), maxlen,
+	    actual_len);
+	if (error == 0 && *actual_len != 0)
+		iichid_ring_commit(sc, slot, *actual_len);
+
+	return (error);
+}
+
+static void
+iichid_ring_task(void *context, int pending)
+{
+	struct iichid_softc *sc = context;
+	iichid_size_t len;
+	sbintime_t time;
+	uint8_t *buf;
+	int slot;
+
+	mtx_lock(sc->intr_mtx);
+	mtx_lock(&sc->ring_mtx);
+	while (sc->ring_count != 0) {
+		slot = sc->ring_head;
+		buf = IICHID_RING_SLOT(sc, slot) + 2;
+		len = sc->ring_len[slot];
+		time = sc->ring_time[slot];
+		mtx_unlock(&sc->ring_mtx);
+
+		if (sc->open) {
+			hidbus_set_intr_time(sc->intr_ctx, time);
+			sc->intr_handler(sc->intr_ctx, buf, len);
+		}
+
+		mtx_lock(&sc->ring_mtx);
+		/* Ring could be torn down while it was unlocked */
+		if (sc->ring_buf == NULL)
+			break;
+		sc->ring_head = (sc->ring_head + 1) % sc->ring_depth;
+		sc->ring_count--;
+
+		if (!sc->ring_idle || sc->ring_idle_slot != slot)
+			continue;
+		sc->ring_idle = false;
+		time = sc->ring_idle_time;
+		mtx_unlock(&sc->ring_mtx);
+
+		if (sc->open) {
+			hidbus_set_intr_time(sc->intr_ctx, time);
+			sc->intr_handler(sc->intr_ctx, buf, 0);
+		}
+
+		mtx_lock(&sc->ring_mtx);
+		if (sc->ring_buf == NULL)
+			break;
+	}
+	mtx_unlock(&sc->ring_mtx);
+	mtx_unlock(sc->intr_mtx);
+}
+
 static int
 iichid_cmd_write(struct iichid_softc *sc, const void *buf, iichid_size_t len)
 {
@@ -395,6 +809,54 @@ iichid_reset(struct iichid_softc *sc)
 	return (iicbus_transfer(sc->dev, msgs, nitems(msgs)));
 }
 
+/*
+ * 7.2.1 - DEVICE signals RESET completion by placing zero length report in
+ * its input register and asserting interrupt. Idle device returns zero
+ * length report too, so only interrupt raised after the command tells that
+ * reset has completed. Wait for it, then read the response out to deassert
+ * the interrupt line. Without interrupt handler give device fixed time to
+ * settle. iicbus must not be owned by caller as it is released while
+ * waiting. Some devices never send the response so timeout is not an error.
+ */
+static int
+iichid_reset_wait(struct iichid_softc *sc, uint64_t intrs)
+{
+	device_t parent = device_get_parent(sc->dev);
+	uint8_t actbuf[2];
+	struct iic_msg msgs[] = {
+	    { sc->addr, IIC_M_RD, sizeof(actbuf), actbuf },
+	};
+	sbintime_t deadline;
+	int error;
+
+	if (sc->irq_cookie == NULL) {
+		pause_sbt("iichid", mstosbt(IICHID_RESET_SETTLE), 0, 0);
+	} else {
+		deadline = sbinuptime() + mstosbt(IICHID_RESET_TIMEOUT);
+		while (sc->stat_intrs == intrs) {
+			if (sbinuptime() >= deadline) {
+				DPRINTF(sc, "no reset response within %d ms\n",
+				    IICHID_RESET_TIMEOUT);
+				return (IIC_ETIMEOUT);
+			}
+			pause("iichid", (hz + 999) / 1000);
+		}
+	}
+
+	error = iicbus_request_bus(parent, sc->dev, IIC_WAIT);
+	if (error != 0)
+		return (error);
+	error = iicbus_transfer(sc->dev, msgs, nitems(msgs));
+	iicbus_release_bus(parent, sc->dev);
+	if (error == 0 && (actbuf[0] != 0 || actbuf[1] != 0))
+		DPRINTF(sc, "unexpected reset response %*D\n",
+		    (int)sizeof(actbuf), actbuf, " ");
+	else if (error == 0)
+		DPRINTF(sc, "reset completed\n");
+
+	return (error);
+}
+
 static int
 iichid_cmd_get_report_desc(struct iichid_softc* sc, void *buf,
     iichid_size_t len)
@@ -418,9 +880,16 @@ iichid_cmd_get_report_desc(struct iichid_softc* sc, void *buf,
 	return (0);
 }
 
+/* Command buffers of single GET_REPORT or SET_REPORT request */
+struct iichid_cmd_buf {
+	uint8_t		cmd[9];
+	uint8_t		actbuf[2];
+};
+
 static int
-iichid_cmd_get_report(struct iichid_softc* sc, void *buf, iichid_size_t maxlen,
-    iichid_size_t *actual_len, uint8_t type, uint8_t id)
+iichid_get_report_msgs(struct iichid_softc *sc, struct iic_msg *msgs,
+    struct iichid_cmd_buf *cb, void *buf, iichid_size_t maxlen, uint8_t type,
+    uint8_t id)
 {
 	/*
 	 * 7.2.2.4 - "The protocol is optimized for Report < 15.  If a
@@ -440,30 +909,34 @@ iichid_cmd_get_report(struct iichid_softc* sc, void *buf, iichid_size_t maxlen,
 			    (id >= 15 ?    dtareg[1]	:	0	  ),
 			};
 	int cmdlen    =	    (id >= 15 ?		7	:	6	  );
-	uint8_t actbuf[2] = { 0, 0 };
-	uint16_t actlen;
-	int d, error;
-	struct iic_msg msgs[] = {
-	    { sc->addr, IIC_M_WR | IIC_M_NOSTOP, cmdlen, cmd },
-	    { sc->addr, IIC_M_RD | IIC_M_NOSTOP, 2, actbuf },
-	    { sc->addr, IIC_M_RD | IIC_M_NOSTART, maxlen, buf },
-	};
-
-	if (maxlen == 0)
-		return (EINVAL);
 
 	DPRINTF(sc, "HID command I2C_HID_CMD_GET_REPORT %d "
 	    "(type %d, len %d)\n", id, type, maxlen);
 
+	memcpy(cb->cmd, cmd, cmdlen);
+	cb->actbuf[0] = cb->actbuf[1] = 0;
+	msgs[0] = (struct iic_msg)
+	    { sc->addr, IIC_M_WR | IIC_M_NOSTOP, cmdlen, cb->cmd };
+	msgs[1] = (struct iic_msg)
+	    { sc->addr, IIC_M_RD | IIC_M_NOSTOP, 2, cb->actbuf };
+	msgs[2] = (struct iic_msg)
+	    { sc->addr, IIC_M_RD | IIC_M_NOSTART, maxlen, buf };
+
+	return (3);
+}
+
+static int
+iichid_get_report_done(struct iichid_softc *sc, struct iichid_cmd_buf *cb,
+    void *buf, iichid_size_t maxlen, iichid_size_t *actual_len, uint8_t id)
+{
+	uint16_t actlen;
+	int d;
+
 	/*
 	 * 7.2.2.2 - Response will be a 2-byte length value, the report
 	 * id (1 byte, if defined in Report Descriptor), and then the report.
 	 */
-	error = iicbus_transfer(sc->dev, msgs, nitems(msgs));
-	if (error != 0)
-		return (error);
-
-	actlen = actbuf[0] | actbuf[1] << 8;
+	actlen = cb->actbuf[0] | cb->actbuf[1] << 8;
 	if (actlen != maxlen + 2)
 		DPRINTF(sc, "response size %d != expected length %d\n",
 		    actlen, maxlen + 2);
@@ -483,14 +956,35 @@ iichid_cmd_get_report(struct iichid_softc* sc, void *buf, iichid_size_t maxlen,
 	if (actual_len != NULL)
 		*actual_len = actlen;
 
-	DPRINTF(sc, "response: %*D %*D\n", 2, actbuf, " ", actlen, buf, " ");
+	DPRINTF(sc, "response: %*D %*D\n", 2, cb->actbuf, " ", actlen, buf,
+	    " ");
 
 	return (0);
 }
 
 static int
-iichid_cmd_set_report(struct iichid_softc* sc, const void *buf,
-    iichid_size_t len, uint8_t type, uint8_t id)
+iichid_cmd_get_report(struct iichid_softc* sc, void *buf, iichid_size_t maxlen,
+    iichid_size_t *actual_len, uint8_t type, uint8_t id)
+{
+	struct iichid_cmd_buf cb;
+	struct iic_msg msgs[3];
+	int error, nmsgs;
+
+	if (maxlen == 0)
+		return (EINVAL);
+
+	nmsgs = iichid_get_report_msgs(sc, msgs, &cb, buf, maxlen, type, id);
+	error = iicbus_transfer(sc->dev, msgs, nmsgs);
+	if (error != 0)
+		return (error);
+
+	return (iichid_get_report_done(sc, &cb, buf, maxlen, actual_len, id));
+}
+
+static int
+iichid_set_report_msgs(struct iichid_softc *sc, struct iic_msg *msgs,
+    struct iichid_cmd_buf *cb, const void *buf, iichid_size_t len,
+    uint8_t type, uint8_t id)
 {
 	/*
 	 * 7.2.2.4 - "The protocol is optimized for Report < 15.  If a
@@ -513,17 +1007,165 @@ iichid_cmd_set_report(struct iichid_softc* sc, const void *buf,
 			    (id >= 15 ?   replen >> 8	:	0	  ),
 			};
 	int cmdlen    =	    (id >= 15 ?		9	:	8	  );
-	struct iic_msg msgs[] = {
-	    {sc->addr, IIC_M_WR | IIC_M_NOSTOP, cmdlen, cmd},
-	    {sc->addr, IIC_M_WR | IIC_M_NOSTART, len, __DECONST(void *, buf)},
-	};
 
 	DPRINTF(sc, "HID command I2C_HID_CMD_SET_REPORT %d (type %d, len %d): "
 	    "%*D\n", id, type, len, len, buf, " ");
 
-	return (iicbus_transfer(sc->dev, msgs, nitems(msgs)));
+	memcpy(cb->cmd, cmd, cmdlen);
+	msgs[0] = (struct iic_msg)
+	    { sc->addr, IIC_M_WR | IIC_M_NOSTOP, cmdlen, cb->cmd };
+	msgs[1] = (struct iic_msg)
+	    { sc->addr, IIC_M_WR | IIC_M_NOSTART, len, __DECONST(void *, buf) };
+
+	return (2);
+}
+
+static int
+iichid_cmd_set_report(struct iichid_softc* sc, const void *buf,
+    iichid_size_t len, uint8_t type, uint8_t id)
+{
+	struct iichid_cmd_buf cb;
+	struct iic_msg msgs[2];
+	int nmsgs;
+
+	nmsgs = iichid_set_report_msgs(sc, msgs, &cb, buf, len, type, id);
+
+	return (iicbus_transfer(sc->dev, msgs, nmsgs));
+}
+
+#ifdef IICHID_SAMPLING
+/*
+ * Convert sampling rate to period. Rates above IICHID_SAMPLING_RATE_MAX
+ * would turn sampling into a busy loop holding the iicbus.
+ */
+static sbintime_t
+iichid_sampling_period(int rate)
+{
+	return (SBT_1S / MIN(MAX(rate, 1), IICHID_SAMPLING_RATE_MAX));
+}
+
+/*
+ * Phase-locked sampling. Time when device has produced a report is estimated
+ * as the middle of interval between preceding empty poll and successful one.
+ * Distance between such estimates gives device report period. Next poll is
+ * placed just after expected time of the next report. Empty polls are
+ * repeated with growing step until device is considered idle. The first
+ * report after a short idle period reseeds the period estimate so that
+ * devices slower than the initial guess are learned as well.
+ * Returns true on transition to idle state.
+ */
+static bool
+iichid_adaptive_sample(struct iichid_softc *sc, sbintime_t now, bool got,
+    sbintime_t *deadline)
+{
+	sbintime_t min_period, max_period, step, report, interval, next;
+	bool idle = false;
+	int shift;
+
+	min_period = iichid_sampling_period(IICHID_SAMPLING_RATE_MAX);
+	max_period = iichid_sampling_period(sc->sampling_rate_slow);
+	step = MAX(sc->sampling_period / 8, min_period);
+
+	if (got) {
+		if (sc->sampling_empty != 0)
+			report = sc->sampling_empty +
+			    (now - sc->sampling_empty) / 2;
+		else
+			report = now - step / 2;
+		interval = report - sc->sampling_anchor;
+		if (sc->sampling_anchor != 0 && interval <= max_period) {
+			/* Reseed after idle, estimate could be too short */
+			if (sc->sampling_idle)
+				sc->sampling_period = interval;
+			else if (interval < 2 * sc->sampling_period)
+				sc->sampling_period +=
+				    (interval - sc->sampling_period) / 8;
+		}
+		sc->sampling_period = MAX(sc->sampling_period, min_period);
+		sc->sampling_period = MIN(sc->sampling_period, max_period);
+		sc->sampling_anchor = report;
+		sc->sampling_empty = 0;
+		sc->sampling_idle = false;
+		next = report + sc->sampling_period + step / 2;
+	} else {
+		sc->sampling_empty = now;
+		if (!sc->sampling_idle && (sc->sampling_anchor == 0 ||
+		    now - sc->sampling_anchor >
+		    (sc->sampling_hysteresis + 1) * sc->sampling_period)) {
+			sc->sampling_idle = true;
+			idle = true;
+		}
+		if (sc->sampling_idle) {
+			next = now + max_period;
+		} else {
+			shift = MIN(MAX(sc->missing_samples - 1, 0), 3);
+			next = now + (step << shift);
+		}
+	}
+
+	*deadline = MAX(next, now + min_period);
+	return (idle);
+}
+
+/*
+ * Schedule next sample at absolute time. Deadlines are advanced by whole
+ * sampling periods from previous deadline rather than from the time the
+ * task has actually run so that timer latency does not accumulate.
+ * Returns true if device has just turned idle.
+ */
+static bool
+iichid_schedule_sample(struct iichid_softc *sc, sbintime_t now, bool got)
+{
+	sbintime_t period, late;
+	bool idle;
+	int rate;
+
+	mtx_assert(sc->intr_mtx, MA_OWNED);
+
+	if (sc->sampling_deadline != 0 && now >= sc->sampling_deadline) {
+		late = sbttous(now - sc->sampling_deadline);
+		sc->stat_wakeups++;
+		sc->stat_lateness += late;
+		if (late > sc->stat_lateness_max)
+			sc->stat_lateness_max = late;
+	}
+
+	if (sc->sampling_adaptive) {
+		idle = iichid_adaptive_sample(sc, now, got,
+		    &sc->sampling_deadline);
+	} else {
+		idle = sc->missing_samples == sc->sampling_hysteresis;
+		rate = sc->missing_samples >= sc->sampling_hysteresis ?
+		    sc->sampling_rate_slow : sc->sampling_rate_fast;
+		period = iichid_sampling_period(rate);
+
+		/* Resync after idle period or if we are late for a period */
+		if (sc->sampling_deadline == 0 ||
+		    sc->sampling_deadline + period <= now)
+			sc->sampling_deadline = now + period;
+		else
+			sc->sampling_deadline += period;
+	}
+
+	taskqueue_enqueue_timeout_sbt(sc->taskqueue, &sc->periodic_task,
+	    sc->sampling_deadline, ustosbt(MAX(sc->sampling_precision, 0)),
+	    C_ABSOLUTE);
+
+	return (idle);
 }
 
+static int
+iichid_sysctl_sampling_period_handler(SYSCTL_HANDLER_ARGS)
+{
+	struct iichid_softc *sc = arg1;
+	int value;
+
+	value = sbttous(sc->sampling_period);
+
+	return (sysctl_handle_int(oidp, &value, 0, req));
+}
+#endif
+
 static void
 iichid_event_task(void *context, int pending)
 {
@@ -532,26 +1174,29 @@ iichid_event_task(void *context, int pending)
 	iichid_size_t maxlen, actual = 0;
 	bool locked = false;
 	int error;
+	sbintime_t now = sbinuptime();
 
-	if (iicbus_request_bus(parent, sc->dev, IIC_WAIT) != 0)
+	if (iicbus_request_bus(parent, sc->dev, IIC_WAIT) != 0) {
+		sc->stat_bus_failures++;
 		goto rearm;
+	}
+	iichid_hist_add(sc->stat_bus_wait, sbinuptime() - now);
 
 	maxlen = sc->power_on ? sc->intr_bufsize : 0;
-	error = iichid_cmd_read(sc, sc->intr_buf, maxlen, &actual);
+	error = iichid_ring_read(sc, maxlen, &actual);
 	iicbus_release_bus(parent, sc->dev);
 	if (error != 0) {
 		DPRINTF(sc, "read error occured: %d\n", error);
 		goto rearm;
 	}
 
-	if (!sc->power_on)
+	/* Interrupt context may be gone, only acknowledge the interrupt */
+	if (!sc->power_on || sc->dying)
 		goto rearm;
 
 	mtx_lock(sc->intr_mtx);
 	locked = true;
 	if (actual > 0) {
-		if (sc->open)
-			sc->intr_handler(sc->intr_ctx, sc->intr_buf, actual);
 #ifdef IICHID_SAMPLING
 		sc->missing_samples = 0;
 #endif
@@ -564,12 +1209,16 @@ iichid_event_task(void *context, int pending)
 
 rearm:
 #ifdef IICHID_SAMPLING
-	if (sc->callout_setup && sc->sampling_rate_slow > 0 && sc->open) {
-		if (sc->missing_samples == sc->sampling_hysteresis)
-			sc->intr_handler(sc->intr_ctx, sc->intr_buf, 0);
-		taskqueue_enqueue_timeout(sc->taskqueue, &sc->periodic_task,
-		    hz / MAX(sc->missing_samples >= sc->sampling_hysteresis ?
-		      sc->sampling_rate_slow : sc->sampling_rate_fast, 1));
+	/* Bus and read failures jump here without the lock taken */
+	if (!locked && !sc->dying) {
+		mtx_lock(sc->intr_mtx);
+		locked = true;
+	}
+	if (locked && sc->callout_setup && sc->sampling_rate_slow > 0 &&
+	    sc->open) {
+		/* Idle notification goes through the ring to keep order */
+		if (iichid_schedule_sample(sc, now, actual > 0))
+			iichid_ring_idle(sc);
 	}
 #endif
 	if (locked)
@@ -583,7 +1232,12 @@ iichid_intr(void *context)
 #ifdef HAVE_IG4_POLLING
 	device_t parent = device_get_parent(sc->dev);
 	iichid_size_t maxlen, actual = 0;
+	sbintime_t start;
 	int error;
+#endif
+
+	sc->stat_intrs++;
+#ifdef HAVE_IG4_POLLING
 
 	/*
 	 * Designware(IG4) driver-specific hack.
@@ -591,8 +1245,12 @@ iichid_intr(void *context)
 	 * mode in the driver, making possible iicbus_transfer execution from
 	 * interrupt handlers and callouts.
 	 */
-	if (iicbus_request_bus(parent, sc->dev, IIC_DONTWAIT) != 0)
+	start = sbinuptime();
+	if (iicbus_request_bus(parent, sc->dev, IIC_DONTWAIT) != 0) {
+		sc->stat_bus_failures++;
 		return;
+	}
+	iichid_hist_add(sc->stat_bus_wait, sbinuptime() - start);
 
 	/*
 	 * Reading of input reports of I2C devices residing in SLEEP state is
@@ -602,26 +1260,23 @@ iichid_intr(void *context)
 	 * acknoledge interrupts we fetch only length header and discard it.
 	 */
 	maxlen = sc->power_on ? sc->intr_bufsize : 0;
-	error = iichid_cmd_read(sc, sc->intr_buf, maxlen, &actual);
+	error = iichid_ring_read(sc, maxlen, &actual);
 	iicbus_release_bus(parent, sc->dev);
 	if (error != 0) {
 		DPRINTF(sc, "read error occured: %d\n", error);
 		return;
 	}
 
-	if (!sc->power_on)
-		return;
-
-	if (actual == 0) {
+	if (sc->power_on && actual == 0)
 		DPRINTF(sc, "no data received\n");
-		return;
-	}
-
-	mtx_lock(sc->intr_mtx);
-	if (sc->open)
-		sc->intr_handler(sc->intr_ctx, sc->intr_buf, actual);
-	mtx_unlock(sc->intr_mtx);
 #else
+	/*
+	 * Interrupt threads are not allowed to sleep while both iicbus
+	 * acquisition and I2C transfer on non-polled controllers do sleep.
+	 * So the report is read from the worker thread. Note that interrupt
+	 * source is unmasked when this handler returns, i.e. before the
+	 * report is read, so level-triggered line may fire again meanwhile.
+	 */
 	taskqueue_enqueue(sc->taskqueue, &sc->event_task);
 #endif
 }
@@ -668,7 +1323,8 @@ again:
 		if (power_on != (sc->open & !sc->suspend))
 			goto again;
 #ifdef IICHID_SAMPLING
-		if (sc->sampling_rate_slow >= 0 && sc->intr_handler != NULL) {
+		if (sc->sampling_rate_slow >= 0 && sc->intr_handler != NULL &&
+		    !sc->dying) {
 			if (power_on) {
 				iichid_setup_callout(sc);
 				iichid_reset_callout(sc);
@@ -692,6 +1348,87 @@ iichid_power_task(void *context, int pending)
 	(void)iichid_set_power_state(sc, IICHID_PS_NOCHANGE);
 }
 
+/*
+ * Bring device back after system resume. If HID descriptor read back from
+ * the device matches cached one, device is assumed to keep its state and
+ * only SET_POWER is issued. Otherwise device is reset and its report
+ * descriptor is compared with cached one.
+ */
+static void
+iichid_resume_task(void *context, int pending)
+{
+	struct iichid_softc *sc = context;
+	device_t parent = device_get_parent(sc->dev);
+	struct i2c_hid_desc desc;
+	uint8_t *rdesc;
+	iichid_size_t len;
+	uint64_t intrs;
+	int error;
+
+	error = iicbus_request_bus(parent, sc->dev, IIC_WAIT);
+	if (error != 0)
+		goto power;
+
+	error = iichid_cmd_get_hid_desc(sc, sc->config_reg, &desc);
+	if (error == 0 && memcmp(&desc, &sc->desc, sizeof(desc)) == 0) {
+		iicbus_release_bus(parent, sc->dev);
+		goto power;
+	}
+
+	device_printf(sc->dev, "HID descriptor %s after resume. Resetting\n",
+	    error != 0 ? "is unreadable" : "has changed");
+	if (error == 0 && le16toh(desc.wHIDDescLength) == 30 &&
+	    le16toh(desc.bcdVersion) == 0x100)
+		sc->desc = desc;
+
+	(void)iichid_set_power(sc, I2C_HID_POWER_ON);
+	pause("iichid", (hz + 999) / 1000);
+	intrs = sc->stat_intrs;
+	error = iichid_reset(sc);
+	if (error == 0) {
+		/* Let other devices on the bus run while reset completes */
+		iicbus_release_bus(parent, sc->dev);
+		(void)iichid_reset_wait(sc, intrs);
+		if (iicbus_request_bus(parent, sc->dev, IIC_WAIT) != 0)
+			goto power;
+		/* Device is powered on after reset */
+		sc->power_on = true;
+	}
+
+	len = le16toh(sc->desc.wReportDescLength);
+	if (sc->rdesc != NULL) {
+		rdesc = malloc(len, M_TEMP, M_WAITOK);
+		error = iichid_cmd_get_report_desc(sc, rdesc, len);
+		if (error != 0 || len != sc->rdesc_len ||
+		    hash32_buf(rdesc, len, HASHINIT) != sc->rdesc_hash) {
+			device_printf(sc->dev, "report descriptor has changed. "
+			    "Device should be reattached\n");
+			free(sc->rdesc, M_DEVBUF);
+			sc->rdesc = NULL;
+		}
+		free(rdesc, M_TEMP);
+	}
+	iicbus_release_bus(parent, sc->dev);
+
+power:
+	error = iichid_set_power_state(sc, IICHID_PS_RESUME);
+	if (error != 0)
+		DPRINTF(sc, "Could not set power_state, error: %d\n", error);
+	else
+		DPRINTF(sc, "Successfully set power_state\n");
+}
+
+/*
+ * HID requests issued by children right after system resume must wait for
+ * the device to be powered on.
+ */
+static void
+iichid_resume_wait(struct iichid_softc *sc)
+{
+
+	taskqueue_drain(sc->taskqueue, &sc->resume_task);
+}
+
 static int
 iichid_setup_interrupt(struct iichid_softc *sc)
 {
@@ -750,6 +1487,11 @@ iichid_reset_callout(struct iichid_softc *sc)
 
 	/* Start with slow sampling */
 	sc->missing_samples = sc->sampling_hysteresis;
+	sc->sampling_deadline = 0;
+	sc->sampling_idle = true;
+	sc->sampling_anchor = 0;
+	sc->sampling_empty = 0;
+	sc->sampling_period = iichid_sampling_period(sc->sampling_rate_fast);
 	taskqueue_enqueue(sc->taskqueue, &sc->event_task);
 
 	return (0);
@@ -762,6 +1504,7 @@ iichid_teardown_callout(struct iichid_softc *sc)
 	mtx_assert(sc->intr_mtx, MA_OWNED);
 
 	sc->callout_setup = false;
+	sc->sampling_deadline = 0;
 	taskqueue_cancel_timeout(sc->taskqueue, &sc->periodic_task, NULL);
 	DPRINTF(sc, "tore callout down\n");
 }
@@ -819,11 +1562,31 @@ iichid_sysctl_sampling_rate_handler(SYSCTL_HANDLER_ARGS)
 }
 #endif /* IICHID_SAMPLING */
 
+static int
+iichid_sysctl_hist_handler(SYSCTL_HANDLER_ARGS)
+{
+	uint64_t *hist = arg1;
+	struct sbuf sb;
+	int error, i;
+
+	sbuf_new_for_sysctl(&sb, NULL, 16 * IICHID_HIST_BUCKETS, req);
+	for (i = 0; i < IICHID_HIST_BUCKETS; i++)
+		sbuf_printf(&sb, "%s%ju", i == 0 ? "" : " ",
+		    (uintmax_t)hist[i]);
+	error = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+
+	return (error);
+}
+
 static void
 iichid_intr_setup(device_t dev, struct mtx *mtx, hid_intr_t intr,
     void *context, struct hidbus_report_descr *rdesc)
 {
 	struct iichid_softc* sc = device_get_softc(dev);
+	uint8_t *ring_buf, *poll_buf;
+	iichid_size_t *ring_len;
+	sbintime_t *ring_time;
 
 	/*
 	 * Do not rely on wMaxInputLength, as some devices may set it to
@@ -836,19 +1599,81 @@ iichid_intr_setup(device_t dev, struct mtx *mtx, hid_intr_t intr,
 	sc->intr_handler = intr;
 	sc->intr_ctx = context;
 	sc->intr_mtx = mtx;
-	sc->intr_buf = malloc(rdesc->rdsize, M_DEVBUF, M_WAITOK | M_ZERO);
+	sc->dying = false;
 	sc->intr_bufsize = rdesc->rdsize;
-	taskqueue_start_threads(&sc->taskqueue, 1, PI_TTY,
-	    "%s taskq", device_get_nameunit(sc->dev));
+	sc->ring_depth = MAX(sc->ring_depth, 1);
+	ring_buf = malloc((sc->ring_depth + 1) * (sc->intr_bufsize + 2),
+	    M_DEVBUF, M_WAITOK | M_ZERO);
+	ring_len = malloc((sc->ring_depth + 1) * sizeof(iichid_size_t),
+	    M_DEVBUF, M_WAITOK | M_ZERO);
+	ring_time = malloc((sc->ring_depth + 1) * sizeof(sbintime_t),
+	    M_DEVBUF, M_WAITOK | M_ZERO);
+	poll_buf = malloc(sc->intr_bufsize + 2, M_DEVBUF, M_WAITOK | M_ZERO);
+
+	mtx_lock(&sc->ring_mtx);
+	sc->ring_buf = ring_buf;
+	sc->ring_len = ring_len;
+	sc->ring_time = ring_time;
+	sc->ring_head = 0;
+	sc->ring_count = 0;
+	sc->ring_idle = false;
+	sc->poll_buf = poll_buf;
+	mtx_unlock(&sc->ring_mtx);
+
+	iicbus_request_bus(device_get_parent(sc->dev), sc->dev, IIC_WAIT);
+	sc->intr_index = rdesc->index;
+	iicbus_release_bus(device_get_parent(sc->dev), sc->dev);
 }
 
 static void
 iichid_intr_unsetup(device_t dev)
 {
 	struct iichid_softc* sc = device_get_softc(dev);
+	device_t parent = device_get_parent(sc->dev);
+	uint8_t *ring_buf, *poll_buf;
+	iichid_size_t *ring_len;
+	sbintime_t *ring_time;
+
+	/*
+	 * Event and power tasks rearm sampling and each other. Forbid that
+	 * before draining them, so nothing is left queued on the shared
+	 * worker once interrupt context is gone.
+	 */
+	mtx_lock(sc->intr_mtx);
+	sc->dying = true;
+#ifdef IICHID_SAMPLING
+	if (sc->callout_setup)
+		iichid_teardown_callout(sc);
+#endif
+	mtx_unlock(sc->intr_mtx);
+
+	/*
+	 * Readers fill ring slots with iicbus acquired, so wait for the one
+	 * in progress before unpublishing the ring. Interrupt handler keeps
+	 * running and may enqueue event task after it has been drained.
+	 */
+	iicbus_request_bus(parent, sc->dev, IIC_WAIT);
+	mtx_lock(&sc->ring_mtx);
+	ring_buf = sc->ring_buf;
+	ring_len = sc->ring_len;
+	ring_time = sc->ring_time;
+	poll_buf = sc->poll_buf;
+	sc->ring_buf = NULL;
+	sc->ring_len = NULL;
+	sc->ring_time = NULL;
+	sc->ring_head = 0;
+	sc->ring_count = 0;
+	sc->ring_idle = false;
+	sc->poll_buf = NULL;
+	mtx_unlock(&sc->ring_mtx);
+	sc->intr_index = NULL;
+	iicbus_release_bus(parent, sc->dev);
 
-	taskqueue_drain_all(sc->taskqueue);
-	free(sc->intr_buf, M_DEVBUF);
+	iichid_drain_tasks(sc);
+	free(poll_buf, M_DEVBUF);
+	free(ring_time, M_DEVBUF);
+	free(ring_len, M_DEVBUF);
+	free(ring_buf, M_DEVBUF);
 }
 
 static int
@@ -891,12 +1716,19 @@ static void
 iichid_intr_poll(device_t dev)
 {
 	struct iichid_softc* sc = device_get_softc(dev);
+	uint8_t *rdbuf = sc->poll_buf;
 	iichid_size_t actual = 0;
 	int error;
 
-	error = iichid_cmd_read(sc, sc->intr_buf, sc->intr_bufsize, &actual);
+	/*
+	 * Polled mode bypasses the ring and reports synchronously. It uses
+	 * own buffer as overrun slot may be filled by worker thread.
+	 */
+	if (rdbuf == NULL)
+		return;
+	error = iichid_intr_read(sc, rdbuf, sc->intr_bufsize, &actual);
 	if (error == 0 && actual != 0 && sc->open)
-		sc->intr_handler(sc->intr_ctx, sc->intr_buf, actual);
+		sc->intr_handler(sc->intr_ctx, rdbuf + 2, actual);
 }
 
 /*
@@ -908,6 +1740,12 @@ iichid_get_report_desc(device_t dev, void *buf, hid_size_t len)
 	struct iichid_softc* sc = device_get_softc(dev);
 	int error;
 
+	/* Report descriptor does not change unless device is reset */
+	if (sc->rdesc != NULL && sc->rdesc_len == len) {
+		memcpy(buf, sc->rdesc, len);
+		return (0);
+	}
+
 	error = iichid_cmd_get_report_desc(sc, buf, len);
 	if (error) {
 		device_printf(dev, "failed to fetch report descriptor: %d\n",
@@ -915,6 +1753,12 @@ iichid_get_report_desc(device_t dev, void *buf, hid_size_t len)
 		return (ENXIO);
 	}
 
+	free(sc->rdesc, M_DEVBUF);
+	sc->rdesc = malloc(len, M_DEVBUF, M_WAITOK);
+	memcpy(sc->rdesc, buf, len);
+	sc->rdesc_len = len;
+	sc->rdesc_hash = hash32_buf(buf, len, HASHINIT);
+
 	return (0);
 }
 
@@ -928,6 +1772,7 @@ iichid_read(device_t dev, void *buf, hid_size_t maxlen, hid_size_t *actlen)
 	if (maxlen > IICHID_SIZE_MAX)
 		return (EMSGSIZE);
 
+	iichid_resume_wait(sc);
 	error = iicbus_request_bus(parent, sc->dev, IIC_WAIT);
 	if (error == 0) {
 		error = iichid_cmd_read(sc, buf, maxlen, actlen);
@@ -945,6 +1790,7 @@ iichid_write(device_t dev, const void *buf, hid_size_t len)
 	if (len > IICHID_SIZE_MAX)
 		return (EMSGSIZE);
 
+	iichid_resume_wait(sc);
 	return (iic2errno(iichid_cmd_write(sc, buf, len)));
 }
 
@@ -957,6 +1803,7 @@ iichid_get_report(device_t dev, void *buf, hid_size_t maxlen,
 	if (maxlen > IICHID_SIZE_MAX)
 		return (EMSGSIZE);
 
+	iichid_resume_wait(sc);
 	return (iic2errno(
 	    iichid_cmd_get_report(sc, buf, maxlen, actlen, type, id)));
 }
@@ -970,9 +1817,88 @@ iichid_set_report(device_t dev, const void *buf, hid_size_t len, uint8_t type,
 	if (len > IICHID_SIZE_MAX)
 		return (EMSGSIZE);
 
+	iichid_resume_wait(sc);
 	return (iic2errno(iichid_cmd_set_report(sc, buf, len, type, id)));
 }
 
+/*
+ * Coalesce all requests into single I2C transfer. If it fails and batch
+ * consists of GET_REPORT requests only, reissue them one by one to find
+ * out which one is failing.
+ */
+static int
+iichid_batch_report(device_t dev, struct hid_report_req *reqs, int nreqs)
+{
+	struct iichid_softc* sc = device_get_softc(dev);
+	device_t parent = device_get_parent(sc->dev);
+	struct iichid_cmd_buf *cbs;
+	struct iic_msg *msgs;
+	struct hid_report_req *req;
+	bool has_set = false;
+	int error, i, nmsgs = 0;
+
+	if (nreqs <= 0)
+		return (0);
+
+	for (req = reqs; req < reqs + nreqs; req++) {
+		req->actlen = 0;
+		req->error = 0;
+		has_set |= req->set;
+	}
+	for (req = reqs; req < reqs + nreqs; req++) {
+		if (req->len > IICHID_SIZE_MAX)
+			req->error = EMSGSIZE;
+		else if (!req->set && req->len == 0)
+			req->error = EINVAL;
+		if (req->error != 0)
+			return (req->error);
+	}
+
+	cbs = malloc(nreqs * sizeof(*cbs), M_TEMP, M_WAITOK);
+	msgs = malloc(nreqs * 3 * sizeof(*msgs), M_TEMP, M_WAITOK);
+
+	for (i = 0; i < nreqs; i++) {
+		req = reqs + i;
+		if (req->set)
+			nmsgs += iichid_set_report_msgs(sc, msgs + nmsgs,
+			    cbs + i, req->data, req->len, req->type, req->id);
+		else
+			nmsgs += iichid_get_report_msgs(sc, msgs + nmsgs,
+			    cbs + i, req->data, req->len, req->type, req->id);
+	}
+
+	iichid_resume_wait(sc);
+	error = iicbus_request_bus(parent, sc->dev, IIC_WAIT);
+	if (error != 0) {
+		error = iic2errno(error);
+		goto done;
+	}
+
+	error = iicbus_transfer(sc->dev, msgs, nmsgs);
+	for (i = 0; i < nreqs; i++) {
+		req = reqs + i;
+		if (error != 0 && has_set)
+			req->error = error;
+		else if (error != 0)
+			req->error = iichid_cmd_get_report(sc, req->data,
+			    req->len, &req->actlen, req->type, req->id);
+		else if (!req->set)
+			req->error = iichid_get_report_done(sc, cbs + i,
+			    req->data, req->len, &req->actlen, req->id);
+		req->error = iic2errno(req->error);
+	}
+	iicbus_release_bus(parent, sc->dev);
+
+	error = 0;
+	for (req = reqs; req < reqs + nreqs && error == 0; req++)
+		error = req->error;
+done:
+	free(msgs, M_TEMP);
+	free(cbs, M_TEMP);
+
+	return (error);
+}
+
 static int
 iichid_set_idle(device_t dev, uint16_t duration, uint8_t id)
 {
@@ -1130,13 +2056,19 @@ iichid_attach(device_t dev)
 		device_printf(dev, "failed to reset hardware: %d\n", error);
 		return (ENXIO);
 	}
+	/* Interrupt is not set up yet */
+	(void)iichid_reset_wait(sc, 0);
 
 	sc->power_on = false;
 	TASK_INIT(&sc->event_task, 0, iichid_event_task, sc);
 	TASK_INIT(&sc->power_task, 0, iichid_power_task, sc);
-	/* taskqueue_create can't fail with M_WAITOK mflag passed */
-	sc->taskqueue = taskqueue_create("imt_tq", M_WAITOK | M_ZERO,
-	    taskqueue_thread_enqueue, &sc->taskqueue);
+	TASK_INIT(&sc->resume_task, 0, iichid_resume_task, sc);
+	TASK_INIT(&sc->ring_task, 0, iichid_ring_task, sc);
+	mtx_init(&sc->ring_mtx, "iichid ring lock", NULL, MTX_DEF);
+	sc->ring_depth = IICHID_RING_DEPTH;
+	sc->taskqueue = iichid_worker_get(device_get_parent(dev));
+	/* No interrupt context until hidbus sets it up */
+	sc->dying = true;
 #ifdef IICHID_SAMPLING
 	TIMEOUT_TASK_INIT(sc->taskqueue, &sc->periodic_task, 0,
 	    iichid_event_task, sc);
@@ -1144,6 +2076,8 @@ iichid_attach(device_t dev)
 	sc->sampling_rate_slow = -1;
 	sc->sampling_rate_fast = IICHID_SAMPLING_RATE_FAST;
 	sc->sampling_hysteresis = IICHID_SAMPLING_HYSTERESIS;
+	sc->sampling_precision = IICHID_SAMPLING_PRECISION;
+	sc->sampling_adaptive = false;
 #endif
 
 	sc->irq_rid = 0;
@@ -1184,8 +2118,126 @@ iichid_attach(device_t dev)
 		OID_AUTO, "sampling_hysteresis", CTLTYPE_INT | CTLFLAG_RWTUN,
 		&sc->sampling_hysteresis, 0,
 		"number of missing samples before enabling of slow mode");
+	SYSCTL_ADD_INT(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "sampling_precision", CTLTYPE_INT | CTLFLAG_RWTUN,
+		&sc->sampling_precision, 0,
+		"allowed deviation of sampling time in usec");
+	SYSCTL_ADD_BOOL(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "sampling_adaptive", CTLFLAG_RWTUN,
+		&sc->sampling_adaptive, 0,
+		"align samples to learned device report period");
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "sampling_period", CTLTYPE_INT | CTLFLAG_RD,
+		sc, 0, iichid_sysctl_sampling_period_handler, "I",
+		"learned device report period in usec");
+	SYSCTL_ADD_U64(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "sampling_wakeups", CTLFLAG_RD,
+		&sc->stat_wakeups, 0,
+		"number of sampling timer wakeups");
+	SYSCTL_ADD_U64(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "sampling_lateness", CTLFLAG_RD,
+		&sc->stat_lateness, 0,
+		"total delay of sampling timer wakeups in usec");
+	SYSCTL_ADD_U64(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "sampling_lateness_max", CTLFLAG_RD,
+		&sc->stat_lateness_max, 0,
+		"maximal delay of sampling timer wakeup in usec");
 #endif /* IICHID_SAMPLING */
 
+	SYSCTL_ADD_INT(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "ring_depth", CTLFLAG_RDTUN,
+		&sc->ring_depth, 0,
+		"number of input reports queued for processing");
+	SYSCTL_ADD_INT(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "ring_count_max", CTLFLAG_RD,
+		&sc->ring_count_max, 0,
+		"maximal number of queued input reports");
+	SYSCTL_ADD_U64(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "ring_overruns", CTLFLAG_RD,
+		&sc->stat_overruns, 0,
+		"input reports dropped due to full ring");
+
+	sc->single_read = true;
+	SYSCTL_ADD_BOOL(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "single_read", CTLFLAG_RWTUN,
+		&sc->single_read, 0,
+		"read input reports with single I2C transfer");
+	SYSCTL_ADD_U64(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "reads_single", CTLFLAG_RD,
+		&sc->stat_reads_single, 0,
+		"input reports read with single transfer");
+	SYSCTL_ADD_U64(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "reads_split", CTLFLAG_RD,
+		&sc->stat_reads_split, 0,
+		"input reports read with separate header transfer");
+	SYSCTL_ADD_U64(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "xfers", CTLFLAG_RD,
+		&sc->stat_xfers, 0,
+		"I2C transfers issued to read input reports");
+	SYSCTL_ADD_U64(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "intrs", CTLFLAG_RD,
+		&sc->stat_intrs, 0,
+		"interrupts taken");
+	SYSCTL_ADD_U64(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "reads", CTLFLAG_RD,
+		&sc->stat_reads, 0,
+		"input report reads issued");
+	SYSCTL_ADD_U64(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "empty_reads", CTLFLAG_RD,
+		&sc->stat_empty_reads, 0,
+		"reads returned no input report");
+	SYSCTL_ADD_U64(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "long_reports", CTLFLAG_RD,
+		&sc->stat_long_reports, 0,
+		"reports longer than wMaxInputLength");
+	SYSCTL_ADD_U64(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "oversized_reports", CTLFLAG_RD,
+		&sc->stat_big_reports, 0,
+		"reports longer than report descriptor allows");
+	SYSCTL_ADD_U64(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "short_reports", CTLFLAG_RD,
+		&sc->stat_short_reports, 0,
+		"reports shorter than report descriptor describes");
+	SYSCTL_ADD_U64(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "bus_failures", CTLFLAG_RD,
+		&sc->stat_bus_failures, 0,
+		"failed iicbus acquisitions");
+	SYSCTL_ADD_U64(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "read_errors", CTLFLAG_RD,
+		&sc->stat_read_errors, 0,
+		"failed input report reads");
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "bus_wait_hist", CTLTYPE_STRING | CTLFLAG_RD,
+		sc->stat_bus_wait, 0, iichid_sysctl_hist_handler, "A",
+		"log2 histogram of iicbus acquisition time in usec");
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "xfer_time_hist", CTLTYPE_STRING | CTLFLAG_RD,
+		sc->stat_xfer_time, 0, iichid_sysctl_hist_handler, "A",
+		"log2 histogram of input report read time in usec");
+
 	child = device_add_child(dev, "hidbus", -1);
 	if (child == NULL) {
 		device_printf(sc->dev, "Could not add I2C device\n");
@@ -1219,9 +2271,14 @@ iichid_detach(device_t dev)
 		bus_release_resource(dev, SYS_RES_IRQ, sc->irq_rid,
 		    sc->irq_res);
 
-	if (sc->taskqueue)
-		taskqueue_free(sc->taskqueue);
+	if (sc->taskqueue) {
+		iichid_drain_tasks(sc);
+		iichid_worker_put(device_get_parent(dev));
+		mtx_destroy(&sc->ring_mtx);
+	}
 	sc->taskqueue = NULL;
+	free(sc->rdesc, M_DEVBUF);
+	sc->rdesc = NULL;
 
 	return (0);
 }
@@ -1310,6 +2367,8 @@ iichid_suspend(device_t dev)
 
 	DPRINTF(sc, "Suspend called, setting device to power_state 1\n");
 
+	/* Finish previous resume before putting device to sleep */
+	taskqueue_drain(sc->taskqueue, &sc->resume_task);
 	(void)bus_generic_suspend(dev);
 
 	/*
@@ -1331,15 +2390,16 @@ static int
 iichid_resume(device_t dev)
 {
 	struct iichid_softc *sc = device_get_softc(dev);
-	int error;
 
 	DPRINTF(sc, "Resume called, setting device to power_state 0\n");
 
-	error = iichid_set_power_state(sc, IICHID_PS_RESUME);
-	if (error != 0)
-		DPRINTF(sc, "Could not set power_state, error: %d\n", error);
-	else
-		DPRINTF(sc, "Successfully set power_state\n");
+	/*
+	 * Do not make system resume wait for I2C transfers. Device is powered
+	 * on by the bus worker, HID requests from children wait for it.
+	 * The worker is shared by all devices on the bus, so they are brought
+	 * back one after another.
+	 */
+	taskqueue_enqueue(sc->taskqueue, &sc->resume_task);
 
 	(void)bus_generic_resume(dev);
 
@@ -1371,6 +2431,7 @@ static device_method_t iichid_methods[] = {
 	DEVMETHOD(hid_write,		iichid_write),
 	DEVMETHOD(hid_get_report,	iichid_get_report),
 	DEVMETHOD(hid_set_report,	iichid_set_report),
+	DEVMETHOD(hid_batch_report,	iichid_batch_report),
 	DEVMETHOD(hid_set_idle,		iichid_set_idle),
 	DEVMETHOD(hid_set_protocol,	iichid_set_protocol),
 
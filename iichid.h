@@ -54,11 +54,47 @@ enum {
  * to activate sampling. A value of 0 is possible but will not reset the
  * callout and, thereby, disable further report requests. Do not set the
  * sampling_rate_fast value too high as it may result in periodical lags of
- * cursor motion.
+ * cursor motion. Samples are scheduled with sbintime resolution so rates
+ * above hz are possible. dev.iichid.<unit>.sampling_precision sets how much
+ * the kernel may shift sampling time to coalesce timer interrupts.
+ * With dev.iichid.<unit>.sampling_adaptive set (off by default),
+ * sampling_rate_fast is only an initial guess. Driver learns report period
+ * of the device and polls right after expected report arrival.
+ * sampling_hysteresis is measured in learned periods in this mode.
  */
 #define	IICHID_SAMPLING_RATE_FAST	60
 #define	IICHID_SAMPLING_RATE_SLOW	10
 #define	IICHID_SAMPLING_HYSTERESIS	1
+#define	IICHID_SAMPLING_PRECISION	1000	/* usec */
+#define	IICHID_SAMPLING_RATE_MAX	1000
+
+/*
+ * Input reports are fetched with single I2C transfer which reads both length
+ * header and report body. Set dev.iichid.<unit>.single_read to 0 to issue
+ * separate transfers for header and body like HID over I2C spec suggests.
+ * Driver falls back to this mode automatically after given number of
+ * consecutive errors or if device returns report larger than announced.
+ */
+#define	IICHID_SINGLE_READ_ERRORS	3
+
+/*
+ * Input reports are read into a ring of dev.iichid.<unit>.ring_depth buffers
+ * and passed to hidbus from software interrupt thread, so the next report can
+ * be fetched from the bus while previous one is being processed.
+ */
+#define	IICHID_RING_DEPTH		4
+
+/* Maximal time to wait for RESET command completion, ms */
+#define	IICHID_RESET_TIMEOUT		1000
+/* Time given to RESET command to complete when interrupt is not set up, ms */
+#define	IICHID_RESET_SETTLE		100
+
+/*
+ * Number of buckets in dev.iichid.<unit>.*_hist histograms. Bucket 0 counts
+ * events shorter than 1 usec, bucket N counts [2^(N-1), 2^N) usec and the
+ * last one counts everything longer.
+ */
+#define	IICHID_HIST_BUCKETS		20
 
 /* 5.1.1 - HID Descriptor Format */
 struct i2c_hid_desc {
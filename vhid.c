@@ -0,0 +1,911 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2026 The iichid Authors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+/*
+ * Virtual HID transport. Attaches hidbus on top of report descriptor and
+ * timed report stream supplied by userland through /dev/vhidN character
+ * device. Intended for replaying recorded devices and for load testing of
+ * hidbus and HID drivers.
+ */
+
+#include <sys/param.h>
+#include <sys/bus.h>
+#include <sys/callout.h>
+#include <sys/conf.h>
+#include <sys/fcntl.h>
+#include <sys/filio.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/module.h>
+#include <sys/mutex.h>
+#include <sys/proc.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/systm.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include "hid.h"
+#include "hidbus.h"
+#include "hid_if.h"
+#include "vhid.h"
+
+#define HID_DEBUG_VAR	vhid_debug
+#include "hid_debug.h"
+
+static SYSCTL_NODE(_hw_hid, OID_AUTO, vhid, CTLFLAG_RW, 0,
+    "Virtual HID transport");
+static int vhid_units = 1;
+SYSCTL_INT(_hw_hid_vhid, OID_AUTO, units, CTLFLAG_RDTUN,
+    &vhid_units, 0, "Number of virtual HID devices");
+#ifdef HID_DEBUG
+static int vhid_debug = 0;
+SYSCTL_INT(_hw_hid_vhid, OID_AUTO, debug, CTLFLAG_RWTUN,
+    &vhid_debug, 0, "Debug level");
+#endif
+
+#define	VHID_QUEUE_SIZE		(64 * 1024)	/* Report queue size, bytes */
+
+/* Byte FIFO holding vhid_event records followed by report data */
+struct vhid_queue {
+	uint8_t		*buf;
+	size_t		head;
+	size_t		count;
+};
+
+struct vhid_softc {
+	device_t		sc_dev;
+	struct cdev		*sc_cdev;
+	struct sx		sc_sx;		/* Serializes setup/teardown */
+	struct mtx		sc_mtx;		/* Protects queues */
+
+	struct hid_device_info	sc_hw;
+	void			*sc_rdesc;
+	bool			sc_open;
+	bool			sc_attached;
+
+	/* Interrupt handler context set up by hidbus */
+	hid_intr_t		*sc_intr_handler;
+	void			*sc_intr_ctx;
+	struct mtx		*sc_intr_mtx;
+	uint8_t			*sc_intr_buf;
+	hid_size_t		sc_rdsize;
+	uint8_t			sc_fid;
+	bool			sc_intr_on;
+
+	/* Timed input report stream */
+	struct vhid_queue	sc_in;
+	struct callout		sc_callout;
+	sbintime_t		sc_last;	/* Time of last delivery */
+
+	/* Output and feature reports sent by HID drivers */
+	struct vhid_queue	sc_out;
+	u_int			sc_out_gen;	/* Bumped on queue reset */
+	bool			sc_out_busy;	/* read(2) in progress */
+
+	/* Feature reports returned by GET_REPORT requests */
+	uint8_t			*sc_feature[256];
+	hid_size_t		sc_feature_len[256];
+};
+
+static d_open_t		vhid_open;
+static d_read_t		vhid_read;
+static d_write_t	vhid_write;
+static d_ioctl_t	vhid_ioctl;
+
+static d_priv_dtor_t	vhid_dtor;
+
+static struct cdevsw vhid_cdevsw = {
+	.d_version =	D_VERSION,
+	.d_open =	vhid_open,
+	.d_read =	vhid_read,
+	.d_write =	vhid_write,
+	.d_ioctl =	vhid_ioctl,
+	.d_name =	"vhid",
+};
+
+static device_identify_t vhid_identify;
+static device_probe_t	vhid_probe;
+static device_attach_t	vhid_attach;
+static device_detach_t	vhid_detach;
+
+static void	vhid_callout(void *);
+
+static size_t
+vhid_queue_space(const struct vhid_queue *q)
+{
+
+	return (VHID_QUEUE_SIZE - q->count);
+}
+
+static void
+vhid_queue_put(struct vhid_queue *q, const void *data, size_t len)
+{
+	size_t tail, n;
+
+	KASSERT(len <= vhid_queue_space(q), ("vhid queue overflow"));
+
+	tail = (q->head + q->count) % VHID_QUEUE_SIZE;
+	n = MIN(len, VHID_QUEUE_SIZE - tail);
+	memcpy(q->buf + tail, data, n);
+	memcpy(q->buf, (const uint8_t *)data + n, len - n);
+	q->count += len;
+}
+
+static void
+vhid_queue_peek(const struct vhid_queue *q, void *data, size_t len)
+{
+	size_t n;
+
+	KASSERT(len <= q->count, ("vhid queue underflow"));
+
+	n = MIN(len, VHID_QUEUE_SIZE - q->head);
+	memcpy(data, q->buf + q->head, n);
+	memcpy((uint8_t *)data + n, q->buf, len - n);
+}
+
+static void
+vhid_queue_drop(struct vhid_queue *q, size_t len)
+{
+
+	KASSERT(len <= q->count, ("vhid queue underflow"));
+
+	q->head = (q->head + len) % VHID_QUEUE_SIZE;
+	q->count -= len;
+}
+
+static void
+vhid_queue_get(struct vhid_queue *q, void *data, size_t len)
+{
+
+	vhid_queue_peek(q, data, len);
+	vhid_queue_drop(q, len);
+}
+
+/*
+ * Deliver all input reports whose time has come and schedule callout
+ * for the next one.
+ */
+static void
+vhid_deliver(struct vhid_softc *sc)
+{
+	struct vhid_event ve;
+	sbintime_t now, due;
+	hid_size_t len;
+
+	mtx_assert(sc->sc_intr_mtx, MA_OWNED);
+
+	mtx_lock(&sc->sc_mtx);
+	now = sbinuptime();
+	while (sc->sc_intr_on && sc->sc_in.count != 0) {
+		vhid_queue_peek(&sc->sc_in, &ve, sizeof(ve));
+		due = sc->sc_last + ustosbt(ve.ve_delay);
+		if (due > now) {
+			callout_reset_sbt(&sc->sc_callout, due, 0,
+			    vhid_callout, sc, C_ABSOLUTE);
+			break;
+		}
+		vhid_queue_get(&sc->sc_in, &ve, sizeof(ve));
+		vhid_queue_get(&sc->sc_in, sc->sc_intr_buf, ve.ve_len);
+		len = MIN(ve.ve_len, sc->sc_rdsize);
+		sc->sc_last = due;
+		wakeup(&sc->sc_in);
+		mtx_unlock(&sc->sc_mtx);
+
+		DPRINTFN(5, "len=%d\n", len);
+		sc->sc_intr_handler(sc->sc_intr_ctx, sc->sc_intr_buf, len);
+
+		mtx_lock(&sc->sc_mtx);
+	}
+	mtx_unlock(&sc->sc_mtx);
+}
+
+static void
+vhid_callout(void *arg)
+{
+	struct vhid_softc *sc = arg;
+	struct mtx *mtx;
+
+	/* Interrupt context is cleared before the callout is drained */
+	mtx_lock(&sc->sc_mtx);
+	mtx = sc->sc_intr_mtx;
+	mtx_unlock(&sc->sc_mtx);
+	if (mtx == NULL)
+		return;
+
+	mtx_lock(mtx);
+	vhid_deliver(sc);
+	mtx_unlock(mtx);
+}
+
+/* Pass report sent by HID driver to userland */
+static void
+vhid_report_out(struct vhid_softc *sc, const void *buf, hid_size_t len,
+    uint8_t type)
+{
+	struct vhid_event ve = {
+		.ve_type = type,
+		.ve_len = len,
+	};
+
+	mtx_lock(&sc->sc_mtx);
+	if (vhid_queue_space(&sc->sc_out) < sizeof(ve) + len) {
+		DPRINTF("output queue is full. Report dropped\n");
+	} else {
+		vhid_queue_put(&sc->sc_out, &ve, sizeof(ve));
+		vhid_queue_put(&sc->sc_out, buf, len);
+		wakeup(&sc->sc_out);
+	}
+	mtx_unlock(&sc->sc_mtx);
+}
+
+/* Remember feature report to be returned by GET_REPORT requests */
+static int
+vhid_store_feature(struct vhid_softc *sc, const uint8_t *buf, hid_size_t len,
+    int how)
+{
+	uint8_t *report, *old;
+	uint8_t id;
+
+	report = malloc(len, M_DEVBUF, how);
+	if (report == NULL)
+		return (ENOMEM);
+	memcpy(report, buf, len);
+
+	mtx_lock(&sc->sc_mtx);
+	id = sc->sc_fid != 0 ? buf[0] : 0;
+	old = sc->sc_feature[id];
+	sc->sc_feature[id] = report;
+	sc->sc_feature_len[id] = len;
+	mtx_unlock(&sc->sc_mtx);
+
+	free(old, M_DEVBUF);
+
+	return (0);
+}
+
+static int
+vhid_enqueue(struct vhid_softc *sc, struct vhid_event *ve, const void *buf,
+    int flag)
+{
+	sbintime_t now;
+	int error = 0;
+
+	mtx_lock(&sc->sc_mtx);
+	while (sc->sc_attached &&
+	    vhid_queue_space(&sc->sc_in) < sizeof(*ve) + ve->ve_len) {
+		if (flag & O_NONBLOCK) {
+			error = EWOULDBLOCK;
+			goto exit;
+		}
+		error = mtx_sleep(&sc->sc_in, &sc->sc_mtx, PZERO | PCATCH,
+		    "vhidwr", 0);
+		if (error != 0)
+			goto exit;
+	}
+	if (!sc->sc_attached || sc->sc_intr_handler == NULL) {
+		error = ENXIO;
+		goto exit;
+	}
+	if (ve->ve_len > sc->sc_rdsize) {
+		error = EMSGSIZE;
+		goto exit;
+	}
+
+	/* Do not try to catch up after stream has been idle */
+	if (sc->sc_in.count == 0) {
+		now = sbinuptime();
+		if (sc->sc_last < now)
+			sc->sc_last = now;
+		callout_reset_sbt(&sc->sc_callout,
+		    sc->sc_last + ustosbt(ve->ve_delay), 0, vhid_callout, sc,
+		    C_ABSOLUTE);
+	}
+	vhid_queue_put(&sc->sc_in, ve, sizeof(*ve));
+	vhid_queue_put(&sc->sc_in, buf, ve->ve_len);
+exit:
+	mtx_unlock(&sc->sc_mtx);
+
+	return (error);
+}
+
+static int
+vhid_setup(struct vhid_softc *sc, struct vhid_setup *vs)
+{
+	device_t child;
+	int error;
+
+	sx_assert(&sc->sc_sx, SA_XLOCKED);
+
+	if (sc->sc_attached)
+		return (EBUSY);
+	if (vs->vs_rdesc_size == 0 || vs->vs_rdesc_size > VHID_RDESC_MAX)
+		return (EINVAL);
+
+	sc->sc_rdesc = malloc(vs->vs_rdesc_size, M_DEVBUF, M_WAITOK);
+	error = copyin(vs->vs_rdesc, sc->sc_rdesc, vs->vs_rdesc_size);
+	if (error != 0) {
+		free(sc->sc_rdesc, M_DEVBUF);
+		sc->sc_rdesc = NULL;
+		return (error);
+	}
+
+	bzero(&sc->sc_hw, sizeof(sc->sc_hw));
+	strlcpy(sc->sc_hw.name, vs->vs_name, sizeof(sc->sc_hw.name));
+	snprintf(sc->sc_hw.serial, sizeof(sc->sc_hw.serial), "%s",
+	    device_get_nameunit(sc->sc_dev));
+	sc->sc_hw.idBus = vs->vs_bus;
+	sc->sc_hw.idVendor = vs->vs_vendor;
+	sc->sc_hw.idProduct = vs->vs_product;
+	sc->sc_hw.idVersion = vs->vs_version;
+	sc->sc_hw.rdescsize = vs->vs_rdesc_size;
+
+	mtx_lock(&sc->sc_mtx);
+	sc->sc_attached = true;
+	mtx_unlock(&sc->sc_mtx);
+
+	mtx_lock(&Giant);
+	child = device_add_child(sc->sc_dev, "hidbus", -1);
+	if (child == NULL) {
+		device_printf(sc->sc_dev, "Could not add hidbus device\n");
+		error = ENOMEM;
+	} else {
+		device_set_ivars(child, &sc->sc_hw);
+		error = bus_generic_attach(sc->sc_dev);
+		if (error != 0)
+			device_printf(sc->sc_dev,
+			    "failed to attach child: %d\n", error);
+	}
+	mtx_unlock(&Giant);
+
+	return (error);
+}
+
+static void
+vhid_teardown(struct vhid_softc *sc)
+{
+	int i;
+
+	sx_assert(&sc->sc_sx, SA_XLOCKED);
+
+	/* Stop writers from arming the callout while hidbus goes away */
+	mtx_lock(&sc->sc_mtx);
+	sc->sc_attached = false;
+	wakeup(&sc->sc_in);
+	mtx_unlock(&sc->sc_mtx);
+
+	mtx_lock(&Giant);
+	device_delete_children(sc->sc_dev);
+	mtx_unlock(&Giant);
+	callout_drain(&sc->sc_callout);
+
+	mtx_lock(&sc->sc_mtx);
+	sc->sc_in.head = sc->sc_in.count = 0;
+	sc->sc_out.head = sc->sc_out.count = 0;
+	sc->sc_out_gen++;
+	for (i = 0; i < nitems(sc->sc_feature); i++) {
+		free(sc->sc_feature[i], M_DEVBUF);
+		sc->sc_feature[i] = NULL;
+	}
+	/* Wake everyone */
+	wakeup(&sc->sc_in);
+	wakeup(&sc->sc_out);
+	mtx_unlock(&sc->sc_mtx);
+
+	free(sc->sc_rdesc, M_DEVBUF);
+	sc->sc_rdesc = NULL;
+}
+
+/*
+ * HID interface
+ */
+static void
+vhid_intr_setup(device_t dev, struct mtx *mtx, hid_intr_t intr,
+    void *context, struct hidbus_report_descr *rdesc)
+{
+	struct vhid_softc *sc = device_get_softc(dev);
+	uint8_t *buf;
+
+	rdesc->rdsize = rdesc->isize;
+	rdesc->wrsize = rdesc->grsize = rdesc->srsize = VHID_REPORT_MAX;
+
+	/*
+	 * Children may access up to isize bytes of interrupt buffer while
+	 * report stream records may be up to VHID_REPORT_MAX bytes long.
+	 */
+	buf = malloc(MAX(rdesc->rdsize, VHID_REPORT_MAX), M_DEVBUF,
+	    M_WAITOK | M_ZERO);
+
+	mtx_lock(&sc->sc_mtx);
+	sc->sc_intr_handler = intr;
+	sc->sc_intr_ctx = context;
+	sc->sc_intr_mtx = mtx;
+	sc->sc_intr_buf = buf;
+	sc->sc_rdsize = rdesc->rdsize;
+	sc->sc_fid = rdesc->fid;
+	mtx_unlock(&sc->sc_mtx);
+}
+
+static void
+vhid_intr_unsetup(device_t dev)
+{
+	struct vhid_softc *sc = device_get_softc(dev);
+
+	mtx_lock(&sc->sc_mtx);
+	sc->sc_intr_handler = NULL;
+	sc->sc_intr_ctx = NULL;
+	sc->sc_intr_mtx = NULL;
+	sc->sc_rdsize = 0;
+	mtx_unlock(&sc->sc_mtx);
+
+	callout_drain(&sc->sc_callout);
+
+	free(sc->sc_intr_buf, M_DEVBUF);
+	sc->sc_intr_buf = NULL;
+}
+
+static int
+vhid_intr_start(device_t dev)
+{
+	struct vhid_softc *sc = device_get_softc(dev);
+
+	mtx_assert(sc->sc_intr_mtx, MA_OWNED);
+
+	sc->sc_intr_on = true;
+	mtx_lock(&sc->sc_mtx);
+	sc->sc_last = sbinuptime();
+	mtx_unlock(&sc->sc_mtx);
+	vhid_deliver(sc);
+
+	return (0);
+}
+
+static int
+vhid_intr_stop(device_t dev)
+{
+	struct vhid_softc *sc = device_get_softc(dev);
+
+	mtx_assert(sc->sc_intr_mtx, MA_OWNED);
+
+	sc->sc_intr_on = false;
+	callout_stop(&sc->sc_callout);
+
+	return (0);
+}
+
+static void
+vhid_intr_poll(device_t dev)
+{
+	struct vhid_softc *sc = device_get_softc(dev);
+
+	vhid_deliver(sc);
+}
+
+static int
+vhid_get_report_descr(device_t dev, void *buf, hid_size_t len)
+{
+	struct vhid_softc *sc = device_get_softc(dev);
+
+	if (sc->sc_rdesc == NULL)
+		return (ENXIO);
+
+	memcpy(buf, sc->sc_rdesc, MIN(len, sc->sc_hw.rdescsize));
+
+	return (0);
+}
+
+static int
+vhid_hid_read(device_t dev, void *buf, hid_size_t maxlen, hid_size_t *actlen)
+{
+
+	return (ENOTSUP);
+}
+
+static int
+vhid_hid_write(device_t dev, const void *buf, hid_size_t len)
+{
+	struct vhid_softc *sc = device_get_softc(dev);
+
+	if (len > VHID_REPORT_MAX)
+		return (ENOBUFS);
+
+	vhid_report_out(sc, buf, len, HID_OUTPUT_REPORT);
+
+	return (0);
+}
+
+static int
+vhid_get_report(device_t dev, void *buf, hid_size_t maxlen,
+    hid_size_t *actlen, uint8_t type, uint8_t id)
+{
+	struct vhid_softc *sc = device_get_softc(dev);
+	hid_size_t len;
+	int error = 0;
+
+	if (type != HID_FEATURE_REPORT)
+		return (ENOTSUP);
+
+	mtx_lock(&sc->sc_mtx);
+	if (sc->sc_feature[id] == NULL) {
+		error = EIO;
+	} else {
+		len = MIN(maxlen, sc->sc_feature_len[id]);
+		memcpy(buf, sc->sc_feature[id], len);
+		if (actlen != NULL)
+			*actlen = len;
+	}
+	mtx_unlock(&sc->sc_mtx);
+
+	return (error);
+}
+
+static int
+vhid_set_report(device_t dev, const void *buf, hid_size_t len, uint8_t type,
+    uint8_t id)
+{
+	struct vhid_softc *sc = device_get_softc(dev);
+
+	if (len == 0 || len > VHID_REPORT_MAX)
+		return (EINVAL);
+
+	if (type == HID_FEATURE_REPORT)
+		(void)vhid_store_feature(sc, buf, len, M_NOWAIT);
+	vhid_report_out(sc, buf, len, type);
+
+	return (0);
+}
+
+static int
+vhid_set_idle(device_t dev, uint16_t duration, uint8_t id)
+{
+
+	return (0);
+}
+
+static int
+vhid_set_protocol(device_t dev, uint16_t protocol)
+{
+
+	return (0);
+}
+
+/*
+ * Character device interface
+ */
+static int
+vhid_open(struct cdev *dev, int flag, int mode, struct thread *td)
+{
+	struct vhid_softc *sc = dev->si_drv1;
+	int error;
+
+	if (sc == NULL)
+		return (ENXIO);
+
+	mtx_lock(&sc->sc_mtx);
+	if (sc->sc_open) {
+		mtx_unlock(&sc->sc_mtx);
+		return (EBUSY);
+	}
+	sc->sc_open = true;
+	mtx_unlock(&sc->sc_mtx);
+
+	error = devfs_set_cdevpriv(sc, vhid_dtor);
+	if (error != 0) {
+		mtx_lock(&sc->sc_mtx);
+		sc->sc_open = false;
+		mtx_unlock(&sc->sc_mtx);
+	}
+
+	return (error);
+}
+
+static void
+vhid_dtor(void *data)
+{
+	struct vhid_softc *sc = data;
+
+	/* Virtual device disappears when its creator goes away */
+	sx_xlock(&sc->sc_sx);
+	if (sc->sc_attached)
+		vhid_teardown(sc);
+	sx_xunlock(&sc->sc_sx);
+
+	mtx_lock(&sc->sc_mtx);
+	sc->sc_open = false;
+	mtx_unlock(&sc->sc_mtx);
+}
+
+static int
+vhid_read(struct cdev *dev, struct uio *uio, int flag)
+{
+	struct vhid_softc *sc = dev->si_drv1;
+	struct vhid_event ve;
+	uint8_t *buf;
+	size_t len;
+	u_int gen;
+	bool copied = false;
+	int error = 0;
+
+	buf = malloc(sizeof(ve) + VHID_REPORT_MAX, M_TEMP, M_WAITOK);
+
+	mtx_lock(&sc->sc_mtx);
+	/* Records are dequeued after copyout, so serialize readers */
+	while (sc->sc_out_busy) {
+		error = mtx_sleep(&sc->sc_out_busy, &sc->sc_mtx,
+		    PZERO | PCATCH, "vhidrb", 0);
+		if (error != 0)
+			goto exit;
+	}
+	sc->sc_out_busy = true;
+
+	while (sc->sc_out.count == 0) {
+		if (!sc->sc_attached) {
+			error = ENXIO;
+			goto done;
+		}
+		if (flag & O_NONBLOCK) {
+			error = EWOULDBLOCK;
+			goto done;
+		}
+		error = mtx_sleep(&sc->sc_out, &sc->sc_mtx, PZERO | PCATCH,
+		    "vhidrd", 0);
+		if (error != 0)
+			goto done;
+	}
+
+	/*
+	 * Transfer as many whole records as possible. Record is removed from
+	 * the queue only after it has been copied out successfully.
+	 */
+	while (sc->sc_out.count != 0) {
+		vhid_queue_peek(&sc->sc_out, &ve, sizeof(ve));
+		len = sizeof(ve) + ve.ve_len;
+		if (len > uio->uio_resid) {
+			if (!copied)
+				error = EMSGSIZE;
+			break;
+		}
+		vhid_queue_peek(&sc->sc_out, buf, len);
+		gen = sc->sc_out_gen;
+		mtx_unlock(&sc->sc_mtx);
+
+		error = uiomove(buf, len, uio);
+
+		mtx_lock(&sc->sc_mtx);
+		if (error != 0)
+			break;
+		copied = true;
+		/* Queue could be reset by teardown while it was unlocked */
+		if (gen == sc->sc_out_gen)
+			vhid_queue_drop(&sc->sc_out, len);
+	}
+done:
+	sc->sc_out_busy = false;
+	wakeup(&sc->sc_out_busy);
+exit:
+	mtx_unlock(&sc->sc_mtx);
+	free(buf, M_TEMP);
+
+	return (error);
+}
+
+static int
+vhid_write(struct cdev *dev, struct uio *uio, int flag)
+{
+	struct vhid_softc *sc = dev->si_drv1;
+	struct vhid_event ve;
+	uint8_t *buf;
+	int error = 0;
+
+	buf = malloc(VHID_REPORT_MAX, M_TEMP, M_WAITOK);
+
+	while (uio->uio_resid > 0 && error == 0) {
+		if (uio->uio_resid < sizeof(ve)) {
+			error = EINVAL;
+			break;
+		}
+		error = uiomove(&ve, sizeof(ve), uio);
+		if (error != 0)
+			break;
+		if (ve.ve_len == 0 || ve.ve_len > VHID_REPORT_MAX ||
+		    ve.ve_len > uio->uio_resid) {
+			error = EINVAL;
+			break;
+		}
+		error = uiomove(buf, ve.ve_len, uio);
+		if (error != 0)
+			break;
+
+		switch (ve.ve_type) {
+		case HID_INPUT_REPORT:
+			error = vhid_enqueue(sc, &ve, buf, flag);
+			break;
+		case HID_FEATURE_REPORT:
+			error = vhid_store_feature(sc, buf, ve.ve_len,
+			    M_WAITOK);
+			break;
+		default:
+			error = EINVAL;
+			break;
+		}
+	}
+
+	free(buf, M_TEMP);
+
+	return (error);
+}
+
+static int
+vhid_ioctl(struct cdev *dev, u_long cmd, caddr_t addr, int flag,
+    struct thread *td)
+{
+	struct vhid_softc *sc = dev->si_drv1;
+	int error;
+
+	switch (cmd) {
+	case FIONBIO:
+		/* All handled in the upper FS layer. */
+		return (0);
+
+	case VHID_SETUP:
+		sx_xlock(&sc->sc_sx);
+		error = vhid_setup(sc, (struct vhid_setup *)addr);
+		if (error != 0 && sc->sc_attached)
+			vhid_teardown(sc);
+		sx_xunlock(&sc->sc_sx);
+		return (error);
+
+	case VHID_TEARDOWN:
+		sx_xlock(&sc->sc_sx);
+		if (sc->sc_attached)
+			vhid_teardown(sc);
+		sx_xunlock(&sc->sc_sx);
+		return (0);
+
+	default:
+		return (ENOTTY);
+	}
+}
+
+/*
+ * Device interface
+ */
+static void
+vhid_identify(driver_t *driver, device_t parent)
+{
+	int unit;
+
+	if (device_find_child(parent, "vhid", -1) != NULL)
+		return;
+
+	for (unit = 0; unit < vhid_units; unit++)
+		if (BUS_ADD_CHILD(parent, 0, "vhid", unit) == NULL)
+			break;
+}
+
+static int
+vhid_probe(device_t dev)
+{
+
+	device_set_desc(dev, "Virtual HID transport");
+
+	return (BUS_PROBE_NOWILDCARD);
+}
+
+static int
+vhid_attach(device_t dev)
+{
+	struct vhid_softc *sc = device_get_softc(dev);
+	struct make_dev_args mda;
+	int error;
+
+	sc->sc_dev = dev;
+	sx_init(&sc->sc_sx, "vhid setup lock");
+	mtx_init(&sc->sc_mtx, "vhid lock", NULL, MTX_DEF);
+	callout_init(&sc->sc_callout, 1);
+	sc->sc_in.buf = malloc(VHID_QUEUE_SIZE, M_DEVBUF, M_WAITOK);
+	sc->sc_out.buf = malloc(VHID_QUEUE_SIZE, M_DEVBUF, M_WAITOK);
+
+	make_dev_args_init(&mda);
+	mda.mda_flags = MAKEDEV_WAITOK;
+	mda.mda_devsw = &vhid_cdevsw;
+	mda.mda_uid = UID_ROOT;
+	mda.mda_gid = GID_WHEEL;
+	mda.mda_mode = 0600;
+	mda.mda_si_drv1 = sc;
+
+	error = make_dev_s(&mda, &sc->sc_cdev, "vhid%d", device_get_unit(dev));
+	if (error) {
+		device_printf(dev, "Can not create character device\n");
+		vhid_detach(dev);
+		return (error);
+	}
+
+	return (0);
+}
+
+static int
+vhid_detach(device_t dev)
+{
+	struct vhid_softc *sc = device_get_softc(dev);
+
+	if (sc->sc_cdev != NULL)
+		destroy_dev(sc->sc_cdev);
+
+	sx_xlock(&sc->sc_sx);
+	if (sc->sc_attached)
+		vhid_teardown(sc);
+	sx_xunlock(&sc->sc_sx);
+	callout_drain(&sc->sc_callout);
+
+	free(sc->sc_out.buf, M_DEVBUF);
+	free(sc->sc_in.buf, M_DEVBUF);
+	mtx_destroy(&sc->sc_mtx);
+	sx_destroy(&sc->sc_sx);
+
+	return (0);
+}
+
+static devclass_t vhid_devclass;
+
+static device_method_t vhid_methods[] = {
+	DEVMETHOD(device_identify,	vhid_identify),
+	DEVMETHOD(device_probe,		vhid_probe),
+	DEVMETHOD(device_attach,	vhid_attach),
+	DEVMETHOD(device_detach,	vhid_detach),
+
+	DEVMETHOD(hid_intr_setup,	vhid_intr_setup),
+	DEVMETHOD(hid_intr_unsetup,	vhid_intr_unsetup),
+	DEVMETHOD(hid_intr_start,	vhid_intr_start),
+	DEVMETHOD(hid_intr_stop,	vhid_intr_stop),
+	DEVMETHOD(hid_intr_poll,	vhid_intr_poll),
+
+	/* HID interface */
+	DEVMETHOD(hid_get_report_descr,	vhid_get_report_descr),
+	DEVMETHOD(hid_read,		vhid_hid_read),
+	DEVMETHOD(hid_write,		vhid_hid_write),
+	DEVMETHOD(hid_get_report,	vhid_get_report),
+	DEVMETHOD(hid_set_report,	vhid_set_report),
+	DEVMETHOD(hid_set_idle,		vhid_set_idle),
+	DEVMETHOD(hid_set_protocol,	vhid_set_protocol),
+
+	DEVMETHOD_END
+};
+
+static driver_t vhid_driver = {
+	.name = "vhid",
+	.methods = vhid_methods,
+	.size = sizeof(struct vhid_softc),
+};
+
+DRIVER_MODULE(vhid, nexus, vhid_driver, vhid_devclass, NULL, 0);
+MODULE_DEPEND(vhid, hid, 1, 1, 1);
+MODULE_VERSION(vhid, 1);
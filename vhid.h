@@ -0,0 +1,69 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2026 The iichid Authors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#ifndef _VHID_H_
+#define _VHID_H_
+
+#include <sys/ioccom.h>
+
+#define	VHID_RDESC_MAX		4096	/* Maximal report descriptor size */
+#define	VHID_REPORT_MAX		1024	/* Maximal report size */
+
+/* Virtual HID device parameters passed with VHID_SETUP ioctl */
+struct vhid_setup {
+	char		vs_name[80];
+	uint16_t	vs_bus;
+	uint16_t	vs_vendor;
+	uint16_t	vs_product;
+	uint16_t	vs_version;
+	uint32_t	vs_rdesc_size;
+	const void	*vs_rdesc;
+};
+
+/*
+ * Report stream record. Each record is followed by ve_len bytes of report
+ * data including report ID byte if device uses numbered reports.
+ *
+ * write(2) accepts input reports which are delivered to hidbus ve_delay
+ * microseconds after previous one and feature reports which are returned
+ * to GET_REPORT requests starting from the moment they are written.
+ * read(2) returns output and feature reports sent to device by HID drivers
+ * with ve_delay set to 0.
+ */
+struct vhid_event {
+	uint32_t	ve_delay;	/* Delay after previous report, usec */
+	uint8_t		ve_type;	/* HID_{INPUT,OUTPUT,FEATURE}_REPORT */
+	uint8_t		ve_reserved;
+	uint16_t	ve_len;		/* Length of report data */
+};
+
+#define	VHID_SETUP	_IOW('V', 0x01, struct vhid_setup)
+#define	VHID_TEARDOWN	_IO('V', 0x02)
+
+#endif	/* _VHID_H_ */